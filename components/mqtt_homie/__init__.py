@@ -2,11 +2,14 @@ import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.const import (
     CONF_ID,
+    CONF_NAME,
+    PLATFORM_ESP32,
 )
 from esphome.core import coroutine_with_priority, CORE
 from esphome import automation, controller
 from esphome.components.mqtt import MQTTClientComponent, MQTTMessage
 from esphome.components import logger
+from esphome.helpers import cpp_string_escape, sanitize, snake_case
 from . import homie_schema
 from types import LambdaType
 import os, re
@@ -19,15 +22,104 @@ DEPENDENCIES = ["network"]
 
 class CONFIG:
     PREFIX="prefix"
+    PROTOCOL = "protocol"
     QOS="qos"
     RETAINED="retained"
     LOG_LEVEL = "log_level"
+    LOG = "log"
+    BUFFER_SIZE = "buffer_size"
+    FLUSH_INTERVAL = "flush_interval"
+    RATE = "rate"
+    BURST = "burst"
+    TAGS = "tags"
     STATS_INTERVAL = "stats_interval"
+    PUBLISH_BUDGET = "publish_budget"
+    PUBLISH_TIME_SLICE = "publish_time_slice"
+    QUEUE = "queue"
+    POOL_SIZE = "pool_size"
+    MAX_SIZE = "max_size"
+    OVERFLOW = "overflow"
+    SKIP_UNCHANGED_METADATA = "skip_unchanged_metadata"
+    EXTENDED_STATS = "extended_stats"
+    LATENCY_TRACING = "latency_tracing"
+    PUBLISHER_TASK = "publisher_task"
+    CORE = "core"
+    PRIORITY = "priority"
+    STACK_SIZE = "stack_size"
+    INTERVAL = "interval"
 
 
 mqtt_homie_ns = cg.esphome_ns.namespace("mqtt_homie")
 HomieClient = mqtt_homie_ns.class_("HomieClient", cg.Component)
 HomieDevice = mqtt_homie_ns.class_("HomieDevice", cg.PollingComponent)
+OverflowPolicy = mqtt_homie_ns.enum("OverflowPolicy", is_class=True)
+MessageClass = cg.global_ns.namespace("homie").enum("message_class", is_class=True)
+Protocol = cg.global_ns.namespace("homie").enum("protocol", is_class=True)
+
+# Homie convention version -> (C++ enum, topic level below the prefix)
+PROTOCOLS = {
+    "3.0.1": (Protocol.v3, ""),
+    "5": (Protocol.v5, "5/"),
+}
+
+OVERFLOW_POLICIES = {
+    "replace": OverflowPolicy.REPLACE,
+    "drop_oldest": OverflowPolicy.DROP_OLDEST,
+    "drop_newest": OverflowPolicy.DROP_NEWEST,
+}
+
+# message class -> (C++ enum, default byte cap, default overflow policy), highest priority first
+QUEUE_LANES = {
+    "state": (MessageClass.state, 512, "drop_oldest"),
+    "value": (MessageClass.value, 8192, "replace"),
+    "metadata": (MessageClass.metadata, 16384, "replace"),
+    "stats": (MessageClass.stats, 1024, "replace"),
+    "log": (MessageClass.log, 2048, "drop_oldest"),
+}
+
+def queue_lane_schema(max_size, overflow):
+    return cv.Schema(
+        {
+            cv.Optional(CONFIG.MAX_SIZE, default=max_size): cv.positive_not_null_int,
+            cv.Optional(CONFIG.OVERFLOW, default=overflow): cv.enum(OVERFLOW_POLICIES, lower=True),
+        }
+    )
+
+QUEUE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(lane, default={}): queue_lane_schema(max_size, overflow)
+        for lane, (_, max_size, overflow) in QUEUE_LANES.items()
+    }
+)
+
+LOG_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONFIG.BUFFER_SIZE, default=1024): cv.int_range(min=0, max=65535),
+        cv.Optional(CONFIG.FLUSH_INTERVAL, default="1s"): cv.positive_time_period_milliseconds,
+        # lines per second, 0 disables the rate limit
+        cv.Optional(CONFIG.RATE, default=10): cv.positive_int,
+        cv.Optional(CONFIG.BURST, default=20): cv.positive_not_null_int,
+        cv.Optional(CONFIG.TAGS, default={}): cv.Schema({cv.string: logger.is_log_level}),
+    }
+)
+
+# Serialization and the MQTT handoff run in a pinned task instead of the main loop.
+# Node getters are then called from that task, setters stay on the main loop.
+# ESP32 only: the task calls MQTTClientComponent::publish(), which is safe off the
+# main loop only with the ESP-IDF MQTT client (esp-mqtt locks its outbox).
+# Subscriptions, timers and state transitions stay on the main loop.
+PUBLISHER_TASK_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONFIG.CORE, default=1): cv.int_range(min=0, max=1),
+            cv.Optional(CONFIG.PRIORITY, default=5): cv.int_range(min=1, max=24),
+            cv.Optional(CONFIG.STACK_SIZE, default=4096): cv.int_range(min=2048, max=32768),
+            # retry period while messages wait, the task sleeps until woken otherwise
+            cv.Optional(CONFIG.INTERVAL, default="10ms"): cv.positive_time_period_milliseconds,
+        }
+    ),
+    cv.only_on([PLATFORM_ESP32]),
+)
 
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
@@ -36,15 +128,28 @@ CONFIG_SCHEMA = cv.All(
             cv.GenerateID(HOMIE_DEVICE): cv.declare_id(HomieDevice),
             cv.GenerateID(MQTT_CLIENT): cv.use_id(MQTTClientComponent),
             cv.Optional(CONFIG.PREFIX, default="homie"): cv.string,
+            cv.Optional(CONFIG.PROTOCOL, default="3.0.1"): cv.one_of(*PROTOCOLS, string=True),
 
             cv.Optional(CONFIG.STATS_INTERVAL, default="60s"): cv.update_interval,
+            # queue depth, publish rate, heap fragmentation and loop time in $stats
+            cv.Optional(CONFIG.EXTENDED_STATS, default=False): cv.boolean,
+            # notify -> publish and set -> echo latency histograms in $stats
+            cv.Optional(CONFIG.LATENCY_TRACING, default=False): cv.boolean,
 
             cv.Optional(CONFIG.QOS, default="1"): homie_schema.qos,
             cv.Optional(CONFIG.RETAINED, default="true"): cv.boolean,
 
+            cv.Optional(CONFIG.PUBLISH_BUDGET, default=32): cv.positive_int,
+            cv.Optional(CONFIG.PUBLISH_TIME_SLICE, default="5ms"): cv.positive_time_period_microseconds,
+            cv.Optional(CONFIG.QUEUE, default={}): QUEUE_SCHEMA,
+            cv.Optional(CONFIG.POOL_SIZE, default=8192): cv.int_range(min=0),
+            cv.Optional(CONFIG.SKIP_UNCHANGED_METADATA, default=False): cv.boolean,
+            cv.Optional(CONFIG.PUBLISHER_TASK): PUBLISHER_TASK_SCHEMA,
+
             cv.Optional(CONFIG.LOG_LEVEL, default="warn"): logger.is_log_level,
+            cv.Optional(CONFIG.LOG, default={}): LOG_SCHEMA,
         }
-    ).extend(cv.COMPONENT_SCHEMA).extend(cv.polling_component_schema("1s")),
+    ).extend(cv.COMPONENT_SCHEMA).extend(cv.polling_component_schema("10s")),
 )
 
 def make_homie_message(config, topic, payload):
@@ -52,10 +157,11 @@ def make_homie_message(config, topic, payload):
         return cg.optional(cg.TemplateArguments(MQTTMessage))
 
     prefix = config[CONFIG.PREFIX]
+    version = PROTOCOLS[config[CONFIG.PROTOCOL]][1]
 
     exp = cg.StructInitializer(
         MQTTMessage,
-        ("topic", f"{prefix}/{CORE.name}/{topic}"),
+        ("topic", f"{prefix}/{version}{CORE.name}/{topic}"),
         ("payload", payload),
         ("qos", config[CONFIG.QOS]),
         ("retain", config[CONFIG.RETAINED]),
@@ -75,21 +181,93 @@ async def to_code(config):
     cg.add(mqtt_client.set_last_will(make_homie_message(config, "$state", "lost")))
 
     cg.add(homie_device.set_stats_interval(config[CONFIG.STATS_INTERVAL]))
-
+    if config[CONFIG.EXTENDED_STATS]:
+        cg.add(homie_client.set_extended_stats(True))
+    if config[CONFIG.LATENCY_TRACING]:
+        cg.add(homie_client.set_latency_tracing(True))
+    cg.add(homie_device.set_skip_unchanged_metadata(config[CONFIG.SKIP_UNCHANGED_METADATA]))
+
+    cg.add(homie_client.set_publish_budget(config[CONFIG.PUBLISH_BUDGET],
+                                           config[CONFIG.PUBLISH_TIME_SLICE].total_microseconds))
+    cg.add(homie_client.set_pool_size(config[CONFIG.POOL_SIZE]))
+    for lane, lane_config in config[CONFIG.QUEUE].items():
+        cg.add(homie_client.configure_queue(QUEUE_LANES[lane][0],
+                                            lane_config[CONFIG.MAX_SIZE],
+                                            lane_config[CONFIG.OVERFLOW]))
     cg.add(homie_client.setup_logging(logger.LOG_LEVELS[config[CONFIG.LOG_LEVEL]]))
+    log_config = config[CONFIG.LOG]
+    cg.add(homie_client.configure_log(log_config[CONFIG.BUFFER_SIZE],
+                                      log_config[CONFIG.FLUSH_INTERVAL].total_milliseconds,
+                                      log_config[CONFIG.RATE],
+                                      log_config[CONFIG.BURST]))
+    for tag, level in log_config[CONFIG.TAGS].items():
+        cg.add(homie_client.set_log_tag_level(tag, logger.LOG_LEVELS[level]))
+    if CONFIG.PUBLISHER_TASK in config:
+        task_config = config[CONFIG.PUBLISHER_TASK]
+        cg.add(homie_client.set_publisher_task(task_config[CONFIG.CORE],
+                                               task_config[CONFIG.PRIORITY],
+                                               task_config[CONFIG.STACK_SIZE],
+                                               task_config[CONFIG.INTERVAL].total_milliseconds))
     cg.add(homie_client.start_homie(homie_device,
                                     config[CONFIG.PREFIX],
                                     config[CONFIG.QOS],
                                     config[CONFIG.RETAINED],
+                                    PROTOCOLS[config[CONFIG.PROTOCOL]][0],
                                     ))
 
 
 class HomieNodeBase:
     pass
 
+
+def deadband(value):
+    """Absolute deadband or, with a trailing %, relative to the last published value."""
+    if isinstance(value, str) and value.strip().endswith("%"):
+        return (cv.percentage(value), True)
+    return (cv.positive_float(value), False)
+
+
+@coroutine_with_priority(-1000.0)
+async def homie_topology_to_code(controller):
+    # runs after every component was registered
+    nodes = controller.build_topology()
+    if nodes is None:
+        return
+
+    node_rows, property_rows = [], []
+    for node_id, properties in nodes:
+        node_rows.append(
+            f"{{{cpp_string_escape(node_id)}, {cpp_string_escape(','.join(properties))}, "
+            f"{len(property_rows)}, {len(properties)}}}"
+        )
+        for prop in properties:
+            property_rows.append(
+                f"{{{cpp_string_escape(prop)}, {cpp_string_escape(f'{node_id}/{prop}')}}}"
+            )
+
+    node_list = ",".join(node_id for node_id, _ in nodes)
+    cg.add_global(cg.RawStatement(
+        "static constexpr esphome::mqtt_homie::HomieTopologyNode homie_topology_nodes[] = {\n  "
+        + ",\n  ".join(node_rows) + "\n};\n"
+        "static constexpr esphome::mqtt_homie::HomieTopologyProperty "
+        "homie_topology_properties[] = {\n  "
+        + ",\n  ".join(property_rows) + "\n};\n"
+        "static constexpr esphome::mqtt_homie::HomieTopology homie_topology = {\n"
+        f"  homie_topology_nodes, {len(node_rows)},\n"
+        f"  homie_topology_properties, {len(property_rows)},\n"
+        f"  {cpp_string_escape(node_list)}}};"
+    ))
+
+    homie_device = await cg.get_variable(controller.homie_device_id)
+    cg.add(homie_device.set_topology(cg.RawExpression("&homie_topology")))
+
+
 class HomieController(controller.BaseController):
     CONTROLLER_NAME = "homie"
     CONF_HOMIE_ID = "homie_id"
+    CONF_DEADBAND = "homie_deadband"
+    CONF_MIN_INTERVAL = "homie_min_interval"
+    CONF_HEARTBEAT = "homie_heartbeat"
 
     CLASS_TYPE = {
         "esphome/switch": "Switch",
@@ -114,14 +292,24 @@ class HomieController(controller.BaseController):
         "esphome/valve": "Valve",
     }
 
+    # property ids of node classes, in the order used by the C++ node
+    PROPERTIES = {
+        "Switch": ("state",),
+        "Sensor": ("value",),
+        "BinarySensor": ("state",),
+    }
+
     def __init__(self):
         self.known_classes = self.CLASS_TYPE
-        pass
+        self.known_properties = self.PROPERTIES
+        # (node id, property ids), None once a node with unknown layout is registered
+        self.topology = []
+        self.homie_device_id = None
 
     def extend_component_schema(self, component: str, schema):
         class_type = self.known_classes[component]
         if isinstance(class_type, str):
-            NodeTemplate = mqtt_homie_ns.class_(f"HomieNode{class_type}", cg.Component)
+            NodeTemplate = mqtt_homie_ns.class_(f"HomieNode{class_type}")
         elif isinstance(class_type, LambdaType):
             NodeTemplate = class_type()
         else:
@@ -131,25 +319,69 @@ class HomieController(controller.BaseController):
             {
                 cv.OnlyWith(self.CONF_HOMIE_ID, "mqtt_homie"): cv.declare_id(NodeTemplate),
                 cv.GenerateID(HOMIE_DEVICE): cv.use_id(HomieDevice),
+                cv.Optional(self.CONF_DEADBAND): deadband,
+                cv.Optional(self.CONF_MIN_INTERVAL): cv.positive_time_period_milliseconds,
+                cv.Optional(self.CONF_HEARTBEAT): cv.positive_time_period_milliseconds,
             }
         )
 
     def register_node_class(self, node: HomieNodeBase):
         self.known_classes = self.known_classes | node.CLASS_TYPE
+        self.known_properties = self.known_properties | getattr(node, "PROPERTIES", {})
+
+    def add_topology_node(self, component: str, config):
+        if self.topology is None:
+            return
+        class_type = self.known_classes[component]
+        properties = None
+        if isinstance(class_type, str):
+            properties = self.known_properties.get(class_type)
+        name = config.get(CONF_NAME)
+        if properties is None or not name:
+            # layout known only at runtime, let the device discover it
+            self.topology = None
+            return
+        self.topology.append((sanitize(snake_case(name)), sorted(properties)))
+
+    def build_topology(self):
+        if not self.topology:
+            return None
+        nodes = sorted(self.topology)
+        ids = [node_id for node_id, _ in nodes]
+        if len(set(ids)) != len(ids):
+            return None
+        return nodes
 
     async def register_component(self, component: str, var, config):
         node_id = config.get(self.CONF_HOMIE_ID)
         if not node_id:
             return
+        # nodes are not components, HomieDevice drives them
         node = cg.new_Pvariable(node_id, var)
-        await cg.register_component(node, {})
+
+        policy = [config.get(key) for key in
+                  (self.CONF_DEADBAND, self.CONF_MIN_INTERVAL, self.CONF_HEARTBEAT)]
+        if any(value is not None for value in policy):
+            band, relative = policy[0] or (0.0, False)
+            min_interval, heartbeat = (
+                value.total_milliseconds if value is not None else 0 for value in policy[1:]
+            )
+            cg.add(node.set_publish_policy(band, relative, min_interval, heartbeat))
+
         homie_device = await cg.get_variable(config[HOMIE_DEVICE])
         cg.add(homie_device.attach_node(node))
 
+        if self.homie_device_id is None:
+            self.homie_device_id = config[HOMIE_DEVICE]
+            CORE.add_job(homie_topology_to_code, self)
+        self.add_topology_node(component, config)
+
 def make_homie_cpp_merged():
     FILES = [
         "utils.h",
+        "value_format.h",
         "datatype.h",
+        "typed_value.h",
         "device_state.h",
         "mqtt_event_handler.h",
         "client_event_handler.h",
@@ -167,6 +399,15 @@ def make_homie_cpp_merged():
         output.write("#include <map>\n")
         output.write("#include <string>\n")
         output.write("#include <vector>\n")
+        output.write("#include <limits>\n")
+        output.write("#include <cstdint>\n")
+        output.write("#include <algorithm>\n")
+        output.write("#include <string_view>\n")
+        output.write("#include <functional>\n")
+        output.write("#include <cmath>\n")
+        output.write("#include <cstdio>\n")
+        output.write("#include <cstdlib>\n")
+        output.write("#include <cstring>\n")
         for f in FILES:
             with open(os.path.join(base_path, "homie-cpp", f), "rb") as source:
                 content = source.read().decode("utf-8")
@@ -24,7 +24,13 @@ std::string get_chip_id() { return ESP.getChipId(); }
 
 std::string get_cpu_frequency() { return std::to_string(esphome::arch_get_cpu_freq_hz() / 1000000) + "MHz"; }
 
-std::string get_free_heap() { return std::to_string(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)); }
+std::string get_free_heap() { return std::to_string(get_free_heap_size()); }
+
+uint32_t get_free_heap_size() { return heap_caps_get_free_size(MALLOC_CAP_INTERNAL); }
+
+uint32_t get_largest_free_block() { return heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL); }
+
+uint32_t get_min_free_heap_size() { return heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL); }
 
 }  // namespace esphome::mqtt_homie
 
@@ -18,5 +18,13 @@ std::string get_chip_id();
 std::string get_framework_name();
 std::string get_cpu_frequency();
 std::string get_free_heap();
+uint32_t get_free_heap_size();
+
+#ifdef USE_ESP32
+// largest allocatable block and the lowest free heap since boot
+uint32_t get_largest_free_block();
+uint32_t get_min_free_heap_size();
+#define HOMIE_DEVICE_INFO_HEAP_DETAILS
+#endif
 
 }  // namespace esphome::mqtt_homie
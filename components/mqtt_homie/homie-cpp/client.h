@@ -2,13 +2,27 @@
 #include "mqtt_client.h"
 #include "device.h"
 #include "utils.h"
+#include "value_format.h"
 #include "client_event_handler.h"
 #include <set>
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <limits>
+#include <functional>
 
 namespace homie {
 
 inline const char *bool2str(bool v) { return v ? "true" : "false"; }
 
+// Homie convention version published by the client
+enum class protocol : uint8_t {
+  // one retained message per device, node and property attribute
+  v3,
+  // whole description in a single $description JSON document below <prefix>/5/
+  v5,
+};
+
 class client : private mqtt_event_handler {
   static constexpr auto TAG = "homie:client";
 
@@ -18,78 +32,256 @@ class client : private mqtt_event_handler {
   client_event_handler *handler;
   int qos;
   bool retained;
+  protocol proto;
+
+  enum class info_stage : uint8_t { idle, device, node, property };
+
+  // What happens with messages produced by publish_device_info()
+  enum class info_output : uint8_t {
+    // everything is published
+    all,
+    // metadata is skipped, values are published
+    values_only,
+    // metadata is folded into the digest, nothing is published
+    digest,
+  };
+
+  // Position of publish_device_info() in the device/node/property tree
+  struct device_info_cursor {
+    info_stage current = info_stage::idle;
+    info_output output = info_output::all;
+    size_t node_index = 0;
+    size_t property_index = 0;
+    std::string node_list;
+    // v5: $description built while walking the tree, values_pass publishes the
+    // values after it
+    std::string description;
+    bool values_pass = false;
+  };
+  device_info_cursor info;
+  mutable uint32_t info_digest = 0;
+  // retained metadata produced by the last publish_device_info()
+  mutable size_t info_messages = 0;
+  mutable size_t info_bytes = 0;
+
+  void emit(std::string_view topic, std::string_view value, bool retain,
+            message_class type) const {
+    // only metadata actually handed to the connection is counted
+    if (type == message_class::metadata && info.output == info_output::all) {
+      ++info_messages;
+      info_bytes += topic.size() + value.size();
+    }
+    if (info.output == info_output::digest) {
+      if (type == message_class::metadata)
+        info_digest = utils::fnv1a(value, utils::fnv1a(topic, info_digest));
+      return;
+    }
+    if (info.output == info_output::values_only && type == message_class::metadata)
+      return;
+    mqtt.publish(topic, value, qos, retain, type);
+  }
 
   // Inherited by mqtt_event_handler
-  virtual void on_connect() override {}
+  virtual void on_connect() override {
+    if (handler)
+      handler->on_connection_changed(true);
+  }
   virtual void on_closing() override {
-    publish_device_attribute("$state", enum_to_string(device_state::disconnected));
+    publish_device_attribute("$state", state_to_string(device_state::disconnected), true,
+                             message_class::state);
+  }
+
+  const char *state_to_string(device_state state) const {
+    // Homie 5 has no alert state, problems are reported through values
+    if (proto == protocol::v5 && state == device_state::alert)
+      state = device_state::ready;
+    return enum_to_string(state);
+  }
+  virtual void on_closed() override {
+    if (handler)
+      handler->on_connection_changed(false);
+  }
+  virtual void on_offline() override {
+    if (handler)
+      handler->on_connection_changed(false);
   }
-  virtual void on_closed() override {}
-  virtual void on_offline() override {}
   virtual void on_message(const std::string &topic, const std::string &payload) override {
+    std::string_view view = topic;
     // Check base topic
-    if (topic.size() < base_topic.size())
+    if (view.size() < base_topic.size())
       return;
-    if (topic.compare(0, base_topic.size(), base_topic) != 0)
+    if (view.compare(0, base_topic.size(), base_topic) != 0)
       return;
+    view.remove_prefix(base_topic.size());
 
-    auto parts = utils::split<std::string>(topic, "/", base_topic.size());
-    if (parts.size() < 2)
-      return;
-    for (auto &e : parts)
-      if (e.empty())
-        return;
-    if (parts[0][0] == '$') {
-      if (parts[0] == "$broadcast") {
-        handle_broadcast(parts[1], payload);
+    if (!view.empty() && view.front() == '$') {
+      utils::tokenizer parts(view, '/');
+      std::string_view kind, level;
+      if (parts.next(kind) && parts.next(level) && kind == "$broadcast" && !level.empty()) {
+        handle_broadcast(std::string(level), payload);
       }
-    } else if (parts[0] == dev->get_id()) {
-      if (parts.size() != 4 || parts[3] != "set" || parts[2][0] == '$')
-        return;
-      handle_property_set(parts[1], parts[2], payload);
+      return;
     }
-  }
 
-  void handle_property_set(const std::string &snode, const std::string &sproperty,
-                           const std::string &payload) {
-    if (snode.empty() || sproperty.empty())
+    constexpr std::string_view set_suffix = "/set";
+    view = topic;
+    if (view.size() <= set_suffix.size() ||
+        view.compare(view.size() - set_suffix.size(), set_suffix.size(), set_suffix) != 0)
       return;
-    int64_t id = 0;
-    bool is_array_node = false;
-    auto node = dev->get_node(snode);
+    view.remove_suffix(set_suffix.size());
 
-    if (!node) {
-      // std::string rnode = snode;
-      // auto pos = rnode.find('_');
-      // if (pos != std::string::npos) {
-      //   std::size_t digits = 0;
-      //   id = std::stoll(rnode.substr(pos + 1), &digits);
-      //   if (digits > 0) {
-      //     is_array_node = true;
-      //     rnode.resize(pos);
-      //   }
-      // }
-      // auto node = dev->get_node(rnode);
-      // if (node == nullptr || node->is_array() != is_array_node)
-      return;
+    auto entry = find_property_topic(view);
+    if (entry && entry->prop->is_settable())
+      handle_property_set(*entry, payload);
+  }
+  virtual void on_published(std::string_view topic, std::string_view payload) override {
+    if (auto entry = find_property_topic(topic))
+      entry->last_payload = payload_digest::of(payload);
+  }
+
+  // Digest of a published payload, used to skip republishing the same value
+  struct payload_digest {
+    uint32_t hash = 0;
+    uint16_t size = 0;
+    bool valid = false;
+
+    static payload_digest of(std::string_view payload) {
+      return {utils::fnv1a(payload), static_cast<uint16_t>(payload.size()), true};
     }
+    bool operator==(const payload_digest &other) const {
+      return valid && other.valid && hash == other.hash && size == other.size;
+    }
+  };
+
+  // Value topic <base>/<device>/<node>/<property> of a property, the set topic
+  // is the same with "/set" appended
+  struct property_topic {
+    node_ptr node;
+    property_ptr prop;
+    // location of the topic in topic_storage
+    uint32_t offset = 0;
+    uint16_t length = 0;
+    // only compiled for settable properties
+    compiled_format format;
+    // last value handed to the broker connection, invalid while a value is
+    // queued so a dropped message is not mistaken for a published one
+    mutable payload_digest last_payload;
+  };
+  // value notifications skipped because the payload was already published
+  mutable uint32_t values_skipped = 0;
+  // "<base><device>/", prefix of all device topics
+  std::string device_topic;
+  // all value topics back to back, refer to it with property_topic::offset/length
+  std::string topic_storage;
+  // sorted by topic
+  std::vector<property_topic> property_topics;
+  // indices into property_topics sorted by property pointer
+  std::vector<uint16_t> property_topic_index;
+  bool topics_valid = false;
+  mutable std::string scratch_topic;
+
+  std::string_view topic_of(const property_topic &entry) const {
+    return std::string_view(topic_storage).substr(entry.offset, entry.length);
+  }
 
-    auto prop = node->get_property(sproperty);
-    if (prop == nullptr) {
+  // Computes all value topics once, they stay valid until invalidate_topics()
+  void build_topics() {
+    if (topics_valid)
       return;
-    }
+    device_topic = utils::concat({base_topic, dev->get_id(), "/"});
+
+    size_t count = 0, size = 0;
+    dev->for_each_node([&count, &size, this](const_node_ptr node) {
+      if (node->is_array())
+        return;
+      node->for_each_property([&count, &size, this, node](const_property_ptr prop) {
+        ++count;
+        size += device_topic.size() + node->get_id().size() + 1 + prop->get_id().size();
+      });
+    });
+
+    topic_storage.clear();
+    topic_storage.reserve(size);
+    property_topics.clear();
+    property_topics.reserve(count);
+    dev->for_each_node([this](node_ptr node) {
+      if (node->is_array())
+        return;
+      node->for_each_property([this, node](property_ptr prop) {
+        const size_t offset = topic_storage.size();
+        topic_storage += device_topic;
+        if (!prop->get_topic_suffix().empty()) {
+          topic_storage += prop->get_topic_suffix();
+        } else {
+          topic_storage += node->get_id();
+          topic_storage += '/';
+          topic_storage += prop->get_id();
+        }
+        property_topic entry{node, prop, static_cast<uint32_t>(offset),
+                             static_cast<uint16_t>(topic_storage.size() - offset),
+                             {}, {}};
+        if (prop->is_settable())
+          entry.format = compiled_format(prop->get_datatype(), std::string(prop->get_format()));
+        property_topics.push_back(std::move(entry));
+      });
+    });
+    std::sort(property_topics.begin(), property_topics.end(),
+              [this](const property_topic &a, const property_topic &b) {
+                return topic_of(a) < topic_of(b);
+              });
+
+    property_topic_index.resize(property_topics.size());
+    for (size_t i = 0; i < property_topic_index.size(); ++i)
+      property_topic_index[i] = static_cast<uint16_t>(i);
+    std::sort(property_topic_index.begin(), property_topic_index.end(),
+              [this](uint16_t a, uint16_t b) {
+                return std::less<const property *>()(property_topics[a].prop,
+                                                     property_topics[b].prop);
+              });
+    topics_valid = true;
+  }
+
+  const property_topic *find_property_topic(std::string_view topic) const {
+    auto it = std::lower_bound(property_topics.begin(), property_topics.end(), topic,
+                               [this](const property_topic &entry, std::string_view topic) {
+                                 return topic_of(entry) < topic;
+                               });
+    if (it == property_topics.end() || topic_of(*it) != topic)
+      return nullptr;
+    return &*it;
+  }
+
+  const property_topic *find_property_topic(const_property_ptr prop) const {
+    auto it = std::lower_bound(property_topic_index.begin(), property_topic_index.end(), prop,
+                               [this](uint16_t index, const_property_ptr prop) {
+                                 return std::less<const property *>()(
+                                     property_topics[index].prop, prop);
+                               });
+    if (it == property_topic_index.end() || property_topics[*it].prop != prop)
+      return nullptr;
+    return &property_topics[*it];
+  }
+
+  void handle_property_set(const property_topic &entry, const std::string &payload) {
+    auto prop = entry.prop;
     if (!prop->is_settable()) {
       return;
     }
 
-    // if (is_array_node)
-    // if (prop->get_value(id) != payload) {
-    //   prop->set_value(id, payload);
-    // } else {
-    if (prop->get_value() != payload) {
-      prop->set_value(payload);
-    }
-    // }
+    typed_value wanted, current;
+    const bool typed = entry.format.parse(payload, wanted) && prop->get_typed_value(current);
+    if (typed && current == wanted)
+      return;
+    // payload not valid for the datatype or no typed support, let property decide
+    if (!typed && prop->get_value() == payload)
+      return;
+
+    // once per applied message, before the property can publish its echo
+    if (handler)
+      handler->on_property_set(entry.node, prop);
+    if (typed && prop->set_typed_value(wanted))
+      return;
+    prop->set_value(payload);
   }
 
   void handle_broadcast(const std::string &level, const std::string &payload) {
@@ -97,46 +289,81 @@ class client : private mqtt_event_handler {
       handler->on_broadcast(level, payload);
   }
 
-  void publish_device_attribute(const std::string &attribute, std::string value,
-                                bool wants_retained = true) const {
-    std::string topic = base_topic + dev->get_id() + "/";
-    if (attribute.front() != '$') {
-      topic += '$';
-    }
-    topic += attribute;
-    mqtt.publish(std::move(topic), std::move(value), qos, retained && wants_retained);
+  static std::string_view attribute_prefix(std::string_view attribute) {
+    return attribute.front() != '$' ? "$" : "";
+  }
+
+  void publish_device_attribute(std::string_view attribute, std::string_view value,
+                                bool wants_retained = true,
+                                message_class type = message_class::metadata) const {
+    emit(utils::concat({device_topic, attribute_prefix(attribute), attribute}), value,
+         retained && wants_retained, type);
   }
 
-  void publish_node_attribute(const_node_ptr node, const std::string &attribute, std::string value,
+  void publish_node_attribute(const_node_ptr node, std::string_view attribute,
+                              std::string_view value,
                               bool wants_retained = true) const {
-    std::string topic = base_topic + dev->get_id() + "/" + node->get_id() + "/";
-    if (attribute.front() != '$') {
-      topic += '$';
-    }
-    topic += attribute;
-    mqtt.publish(std::move(topic), std::move(value), qos, retained && wants_retained);
+    std::string topic = utils::concat(
+        {device_topic, node->get_id(), "/", attribute_prefix(attribute), attribute});
+    emit(topic, value, retained && wants_retained, message_class::metadata);
   }
 
   void publish_property_attribute(const_node_ptr node, const_property_ptr prop,
-                                  const std::string &attribute, std::string value,
+                                  std::string_view attribute, std::string_view value,
                                   bool wants_retained = true) const {
-    std::string topic =
-        base_topic + dev->get_id() + "/" + node->get_id() + "/" + prop->get_id() + "/";
-    if (attribute.front() != '$') {
-      topic += '$';
+    std::string topic = utils::concat(
+        {property_topic_of(node, prop), "/", attribute_prefix(attribute), attribute});
+    emit(topic, value, retained && wants_retained, message_class::metadata);
+  }
+
+  void publish_property_value(const_node_ptr node, const_property_ptr prop,
+                              std::string_view value, bool wants_retained = true,
+                              bool skip_unchanged = false) const {
+    auto entry = find_property_topic(prop);
+    if (info.output == info_output::digest)
+      entry = nullptr;
+    if (entry && skip_unchanged && entry->last_payload == payload_digest::of(value)) {
+      ++values_skipped;
+      return;
+    }
+
+    const bool retain = retained && wants_retained;
+    const auto topic = entry ? topic_of(*entry) : property_topic_of(node, prop);
+    if (info.output != info_output::digest && mqtt.publish_now(topic, value, qos, retain)) {
+      if (entry)
+        entry->last_payload = payload_digest::of(value);
+      return;
     }
-    topic += attribute;
-    mqtt.publish(std::move(topic), std::move(value), qos, retained && wants_retained);
+    // set again by on_published() once the queued value is sent
+    if (entry)
+      entry->last_payload = {};
+    emit(topic, value, retain, message_class::value);
   }
 
-  void publish_property_value(const_node_ptr node, const_property_ptr prop, std::string value,
-                              bool wants_retained = true) const {
-    std::string topic = base_topic + dev->get_id() + "/" + node->get_id() + "/" + prop->get_id();
-    mqtt.publish(std::move(topic), std::move(value), qos, retained && wants_retained);
+  // Publishes the current value of prop, formatted on the stack when the
+  // property supports format_value()
+  void publish_current_value(const_node_ptr node, const_property_ptr prop,
+                             bool skip_unchanged = false) const {
+    char buffer[value_buffer_size];
+    if (const size_t length = prop->format_value(buffer, sizeof(buffer))) {
+      publish_property_value(node, prop, std::string_view(buffer, length), prop->is_retained(),
+                             skip_unchanged);
+      return;
+    }
+    publish_property_value(node, prop, prop->get_value(), prop->is_retained(), skip_unchanged);
+  }
+
+  // Precomputed value topic, built on the spot for properties the table does
+  // not know yet (published before the first connect)
+  std::string_view property_topic_of(const_node_ptr node, const_property_ptr prop) const {
+    if (auto entry = find_property_topic(prop))
+      return topic_of(*entry);
+    scratch_topic = utils::concat({device_topic, node->get_id(), "/", prop->get_id()});
+    return scratch_topic;
   }
 
   void notify_property_changed_impl(const std::string &snode, const std::string &sproperty,
-                                    const int64_t *idx) const {
+                                    const int64_t *idx, bool force = false) const {
     if (snode.empty() || sproperty.empty())
       return;
 
@@ -146,10 +373,11 @@ class client : private mqtt_event_handler {
     auto prop = node->get_property(sproperty);
     if (!prop)
       return;
-    notify_property_changed_impl(node, prop, idx);
+    notify_property_changed_impl(node, prop, idx, force);
   }
 
-  void notify_property_changed_impl(node *node, property *prop, const int64_t *idx) const {
+  void notify_property_changed_impl(node *node, property *prop, const int64_t *idx,
+                                    bool force = false) const {
     if (!node || !prop)
       return;
 
@@ -167,132 +395,338 @@ class client : private mqtt_event_handler {
       //   }
       // }
     } else {
-      publish_property_value(node, prop, prop->get_value(), prop->is_retained());
+      publish_current_value(node, prop, !force);
     }
   }
 
+  size_t publish_device_header() {
+    if (proto == protocol::v5)
+      return begin_description();
+
+    size_t sent = 2;
+    publish_device_attribute("$homie", "3.0.1");
+    publish_device_attribute("$name", dev->get_name());
+
+    dev->for_each_attribute([this, &sent](std::string_view key, std::string_view value) {
+      publish_device_attribute(key, value);
+      ++sent;
+    });
+    return sent;
+  }
+
+  size_t publish_node_header(const_node_ptr node) {
+    if (proto == protocol::v5)
+      return append_node_description(node);
+
+    size_t sent = 3;
+    if (!node->is_array() && dev->get_node_list().empty()) {
+      // array nodes are not supported yet
+      if (!info.node_list.empty()) {
+        info.node_list += ',';
+      }
+      info.node_list += node->get_id();
+    }
+    publish_node_attribute(node, "$name", node->get_name());
+    publish_node_attribute(node, "$type", node->get_type());
+
+    node->for_each_attribute([this, node, &sent](std::string_view key, std::string_view value) {
+      publish_node_attribute(node, key, value);
+      ++sent;
+    });
+
+    std::string properties(node->get_property_list());
+    if (properties.empty()) {
+      node->for_each_property([&properties](const_property_ptr property) {
+        if (!properties.empty()) {
+          properties += ',';
+        }
+        properties += property->get_id();
+      });
+    }
+    publish_node_attribute(node, "$properties", properties);
+    return sent;
+  }
+
+  size_t publish_property_header(const_node_ptr node, const_property_ptr property) {
+    if (proto == protocol::v5)
+      return append_property_description(node, property);
+
+    size_t sent = 6;
+    publish_property_attribute(node, property, "$name", property->get_name());
+    publish_property_attribute(node, property, "$settable", bool2str(property->is_settable()));
+    publish_property_attribute(node, property, "$retained",
+                               bool2str(retained && property->is_retained()));
+    publish_property_attribute(node, property, "$unit", property->get_unit());
+    publish_property_attribute(node, property, "$datatype",
+                               enum_to_string(property->get_datatype()));
+
+    property->for_each_attribute(
+        [this, node, property, &sent](std::string_view key, std::string_view value) {
+          publish_property_attribute(node, property, key, value);
+          ++sent;
+        });
+
+    publish_property_attribute(node, property, "$format", property->get_format());
+
+    if (!node->is_array()) {
+      publish_current_value(node, property);
+      ++sent;
+    }
+    return sent;
+  }
+
+  // Homie 5 $description, written as a stream of JSON fragments into one buffer.
+  // Additional device, node and property attributes have no place in the
+  // Homie 5 description and are left out.
+  size_t begin_description() {
+    if (info.output == info_output::values_only) {
+      info.values_pass = true;
+      return 0;
+    }
+    size_t properties = 0;
+    dev->for_each_node([&properties](const_node_ptr node) {
+      properties += node->get_property_count();
+    });
+    auto &out = info.description;
+    out.reserve(64 + 64 * dev->get_node_count() + 128 * properties);
+    out += "{\"homie\":\"5.0\",\"name\":";
+    utils::append_json_string(out, dev->get_name());
+    out += ",\"nodes\":{";
+    return 1;
+  }
+
+  size_t append_node_description(const_node_ptr node) {
+    if (info.values_pass || node->is_array())
+      return 0;
+    auto &out = info.description;
+    if (out.back() != '{')
+      out += ',';
+    utils::append_json_string(out, node->get_id());
+    out += ":{\"name\":";
+    utils::append_json_string(out, node->get_name());
+    if (!node->get_type().empty()) {
+      out += ",\"type\":";
+      utils::append_json_string(out, node->get_type());
+    }
+    out += ",\"properties\":{";
+    return 1;
+  }
+
+  size_t append_property_description(const_node_ptr node, const_property_ptr property) {
+    if (node->is_array())
+      return 0;
+    if (info.values_pass) {
+      publish_current_value(node, property);
+      return 1;
+    }
+    auto &out = info.description;
+    if (out.back() != '{')
+      out += ',';
+    utils::append_json_string(out, property->get_id());
+    out += ":{\"name\":";
+    utils::append_json_string(out, property->get_name());
+    out += ",\"datatype\":";
+    utils::append_json_string(out, enum_to_string(property->get_datatype()));
+    if (!property->get_format().empty()) {
+      out += ",\"format\":";
+      utils::append_json_string(out, property->get_format());
+    }
+    if (!property->get_unit().empty()) {
+      out += ",\"unit\":";
+      utils::append_json_string(out, property->get_unit());
+    }
+    // defaults are settable=false and retained=true
+    if (property->is_settable())
+      out += ",\"settable\":true";
+    if (!(retained && property->is_retained()))
+      out += ",\"retained\":false";
+    out += '}';
+    return 1;
+  }
+
+  void end_node_description(const_node_ptr node) {
+    if (proto == protocol::v5 && !info.values_pass && !node->is_array())
+      info.description += "}}";
+  }
+
+  // Publishes $description once all nodes are in and restarts the walk for the
+  // values. Returns false when device info is complete.
+  bool end_description() {
+    if (info.values_pass)
+      return false;
+    auto &out = info.description;
+    out += '}';
+    // version changes whenever the rest of the description does
+    out += ",\"version\":";
+    char version[value_buffer_size];
+    out.append(version, format_unsigned(version, sizeof(version), utils::fnv1a(out)));
+    out += '}';
+    publish_device_attribute("$description", out);
+    info.description = {};
+    if (info.output == info_output::digest)
+      return false;
+    info.values_pass = true;
+    info.node_index = 0;
+    return true;
+  }
+
  public:
   client(mqtt_client &con, device_ptr pdev, std::string base_topic = "homie/", int qos = 1,
-         bool retained = true)
+         bool retained = true, protocol proto = protocol::v3)
       : mqtt(con),
-        base_topic(base_topic),
+        base_topic(proto == protocol::v5 ? base_topic + "5/" : base_topic),
         dev(pdev),
         handler(nullptr),
         qos(qos),
-        retained(retained) {
+        retained(retained),
+        proto(proto) {
+    device_topic = utils::concat({this->base_topic, dev->get_id(), "/"});
     mqtt.set_event_handler(this);
-    mqtt.open(base_topic + dev->get_id() + "/$state", enum_to_string(device_state::lost), qos,
-              retained);
+    mqtt.open(this->base_topic + dev->get_id() + "/$state", enum_to_string(device_state::lost),
+              qos, retained);
   }
 
   ~client() { mqtt.set_event_handler(nullptr); }
 
   void stop_subscription() { mqtt.unsubscribe(base_topic + dev->get_id() + "/+/+/set"); }
-  void start_subscription() { mqtt.subscribe(base_topic + dev->get_id() + "/+/+/set", 1); }
+  void start_subscription() {
+    build_topics();
+    mqtt.subscribe(base_topic + dev->get_id() + "/+/+/set", 1);
+  }
+
+  // Drops the precomputed topics, call after nodes, the device id or the
+  // prefix changed. They are rebuilt by the next publish_device_info().
+  void invalidate_topics() {
+    topics_valid = false;
+    topic_storage.clear();
+    property_topics.clear();
+    property_topic_index.clear();
+  }
 
   void notify_property_changed(const std::string &snode, const std::string &sproperty) const {
     notify_property_changed_impl(snode, sproperty, nullptr);
   }
 
-  void notify_property_changed(node *node, property *prop) const {
-    notify_property_changed_impl(node, prop, nullptr);
+  // Publishes the current value unless it equals the last published one,
+  // force publishes it anyway (heartbeats)
+  void notify_property_changed(node *node, property *prop, bool force = false) const {
+    notify_property_changed_impl(node, prop, nullptr, force);
   }
 
+  uint32_t get_values_skipped() const { return values_skipped; }
+  // "<base><device>/", prefix of all device topics
+  std::string_view get_device_topic() const { return device_topic; }
+
   void notify_property_changed(const std::string &snode, const std::string &sproperty,
                                int64_t idx) const {
     notify_property_changed_impl(snode, sproperty, &idx);
   }
 
   void notify_device_state_changed() const {
-    publish_device_attribute("$state", enum_to_string(dev->get_state()));
+    publish_device_attribute("$state", state_to_string(dev->get_state()), true,
+                             message_class::state);
   }
 
   void update_device_stats() const {
-    for (const auto &[key, value] : dev->get_stats()) {
-      publish_device_attribute("$stats/" + key, value, false);
-    }
+    dev->for_each_stat([this](std::string_view key, std::string_view value) {
+      emit(utils::concat({device_topic, "$stats/", key}), value, false, message_class::stats);
+    });
   }
 
-  void publish_log_message(const std::string &message) const {
-    publish_device_attribute("$log", message, false);
+  void publish_log_message(std::string_view message) const {
+    publish_device_attribute("$log", message, false, message_class::log);
   }
 
-  void publish_device_info() const {
-    publish_device_attribute("$homie", "3.0.1");
-    publish_device_attribute("$name", dev->get_name());
+  // Starts publishing device metadata. Messages are produced on demand by
+  // continue_device_info(), so only a few of them exist at any time.
+  // With values_only set retained metadata is assumed to be on the broker
+  // already and only property values are published.
+  void publish_device_info(bool values_only = false) {
+    build_topics();
+    info = {};
+    info.current = info_stage::device;
+    info.output = values_only ? info_output::values_only : info_output::all;
+    info_messages = 0;
+    info_bytes = 0;
+  }
 
-    for (const auto &[key, value] : dev->get_attributes()) {
-      publish_device_attribute(key, value);
+  // Number and size (topic + payload) of retained metadata messages published
+  // by the last publish_device_info(), 0 with values_only
+  size_t get_device_info_messages() const { return info_messages; }
+  size_t get_device_info_bytes() const { return info_bytes; }
+
+  // Digest of all retained metadata publish_device_info() would produce.
+  // Runs the whole cursor at once without publishing anything.
+  uint32_t compute_device_info_digest() {
+    build_topics();
+    auto saved = std::move(info);
+    info = {};
+    info.current = info_stage::device;
+    info.output = info_output::digest;
+    info_digest = utils::fnv1a(base_topic);
+    while (continue_device_info(std::numeric_limits<size_t>::max())) {
     }
+    info = std::move(saved);
+    return info_digest;
+  }
 
-    // Publish nodes
-    std::string nodes = "";
-    for (auto &nodename : dev->get_nodes()) {
-      auto node = dev->get_node(nodename);
-
-      if (node->is_array()) {
-        // nodes += node->get_id() + "[],";
-        // publish_node_attribute(node, "$array",
-        //                              std::to_string(node->array_range().first) + "-" +
-        //                                  std::to_string(node->array_range().second));
-        // for (int64_t i = node->array_range().first; i <= node->array_range().second; i++) {
-        //   auto n = node->get_name(i);
-        //   if (n != "")
-        //     publish_device_attribute(node->get_id() + "_" + std::to_string(i) + "/$name",
-        //     n);
-        // }
-      } else {
-        if (!nodes.empty()) {
-          nodes += ',';
-        }
-        nodes += node->get_id();
-      }
-      publish_node_attribute(node, "$name", node->get_name());
-      publish_node_attribute(node, "$type", node->get_type());
-
-      for (const auto &[key, value] : node->get_attributes()) {
-        publish_node_attribute(node, key, value);
-      }
-
-      // Publish node properties
-      std::string properties = "";
-      for (auto &property_name : node->get_properties()) {
-        auto property = node->get_property(property_name);
-        if (!properties.empty()) {
-          properties += ',';
-        }
-        properties += property->get_id();
-
-        publish_property_attribute(node, property, "$name", property->get_name());
-        publish_property_attribute(node, property, "$settable", bool2str(property->is_settable()));
-        publish_property_attribute(node, property, "$retained",
-                                   bool2str(retained && property->is_retained()));
-        publish_property_attribute(node, property, "$unit", property->get_unit());
-        publish_property_attribute(node, property, "$datatype",
-                                   enum_to_string(property->get_datatype()));
-
-        for (const auto &[key, value] : property->get_attributes()) {
-          publish_property_attribute(node, property, key, value);
+  void cancel_device_info() { info = {}; }
+
+  bool has_pending_device_info() const { return info.current != info_stage::idle; }
+
+  // Publishes the next part of device metadata, stops after at least max_messages
+  // were produced. Returns true when there is more to publish.
+  bool continue_device_info(size_t max_messages) {
+    size_t sent = 0;
+    while (sent < max_messages && info.current != info_stage::idle) {
+      switch (info.current) {
+        case info_stage::device:
+          sent += publish_device_header();
+          info.node_index = 0;
+          info.current = info_stage::node;
+          break;
+
+        case info_stage::node:
+          if (info.node_index >= dev->get_node_count()) {
+            if (proto == protocol::v5) {
+              if (end_description()) {
+                ++sent;
+              } else {
+                info = {};
+              }
+              break;
+            }
+            if (!dev->get_node_list().empty())
+              publish_device_attribute("$nodes", dev->get_node_list());
+            else
+              publish_device_attribute("$nodes", info.node_list);
+            ++sent;
+            info = {};
+            break;
+          }
+          sent += publish_node_header(dev->get_node_at(info.node_index));
+          info.property_index = 0;
+          info.current = info_stage::property;
+          break;
+
+        case info_stage::property: {
+          auto node = dev->get_node_at(info.node_index);
+          if (info.property_index >= node->get_property_count()) {
+            end_node_description(node);
+            ++info.node_index;
+            info.current = info_stage::node;
+            break;
+          }
+          sent += publish_property_header(node, node->get_property_at(info.property_index));
+          ++info.property_index;
+          break;
         }
 
-        publish_property_attribute(node, property, "$format", property->get_format());
-
-        if (!node->is_array()) {
-          publish_property_value(node, property, property->get_value(), property->is_retained());
-        } else {
-          // for (int64_t i = node->array_range().first; i <= node->array_range().second; i++) {
-          //   auto val = property->get_value(i);
-          //   if (!val.empty())
-          //     publish_device_attribute(
-          //         node->get_id() + "_" + std::to_string(i) + "/" + property->get_id(), val,
-          //         property->is_retained());
-          // }
-        }
+        case info_stage::idle:
+          break;
       }
-
-      publish_node_attribute(node, "$properties", properties);
     }
-    publish_device_attribute("$nodes", nodes);
+    return has_pending_device_info();
   }
 
   void set_event_handler(client_event_handler *hdl) { handler = hdl; }
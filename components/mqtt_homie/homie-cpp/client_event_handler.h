@@ -2,7 +2,14 @@
 #include <string>
 
 namespace homie {
+	struct node;
+	struct property;
+
 	struct client_event_handler {
 		virtual void on_broadcast(const std::string& level, const std::string& payload) = 0;
+		// MQTT connection came up or went down
+		virtual void on_connection_changed(bool connected) {}
+		// set command about to be applied to prop of n
+		virtual void on_property_set(const node* n, const property* prop) {}
 	};
 }
\ No newline at end of file
@@ -6,7 +6,7 @@ template<typename T> inline T enum_from_string(const std::string &s);
 
 enum class datatype { integer, number, boolean, string, enumeration, color };
 
-inline std::string enum_to_string(datatype s) {
+inline const char *enum_to_string(datatype s) {
   switch (s) {
     case datatype::integer:
       return "integer";
@@ -14,12 +14,30 @@ struct device {
   virtual const std::string &get_id() const = 0;
   virtual const std::string &get_name() const = 0;
 
-  virtual std::set<std::string> get_nodes() const = 0;
-  virtual node_ptr get_node(const std::string &id) = 0;
-  virtual const_node_ptr get_node(const std::string &id) const = 0;
+  // Nodes are enumerated by index in 0..get_node_count()-1, ordered by id
+  virtual size_t get_node_count() const = 0;
+  virtual node_ptr get_node_at(size_t index) = 0;
+  virtual const_node_ptr get_node_at(size_t index) const = 0;
+  virtual node_ptr get_node(std::string_view id) = 0;
+  virtual const_node_ptr get_node(std::string_view id) const = 0;
 
-  virtual std::map<std::string, std::string> get_attributes() const = 0;
-  virtual std::map<std::string, std::string> get_stats() const = 0;
+  // Calls visitor with every additional attribute (key, value) of the device
+  virtual void for_each_attribute(attribute_visitor visitor) const = 0;
+
+  // Precomputed $nodes payload, empty when it has to be built from the nodes
+  virtual std::string_view get_node_list() const { return {}; }
+
+  void for_each_node(utils::function_ref<void(const_node_ptr)> visitor) const {
+    for (size_t i = 0, count = get_node_count(); i < count; ++i)
+      visitor(get_node_at(i));
+  }
+  void for_each_node(utils::function_ref<void(node_ptr)> visitor) {
+    for (size_t i = 0, count = get_node_count(); i < count; ++i)
+      visitor(get_node_at(i));
+  }
+
+  // Calls visitor with every statistic (key, value) of the device
+  virtual void for_each_stat(attribute_visitor visitor) const = 0;
   virtual device_state get_state() const = 0;
 };
 
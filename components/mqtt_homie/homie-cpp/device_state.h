@@ -6,7 +6,7 @@ template<typename T> inline T enum_from_string(const std::string &s);
 
 enum class device_state : uint8_t { init, ready, disconnected, sleeping, lost, alert };
 
-inline std::string enum_to_string(device_state s) {
+inline const char *enum_to_string(device_state s) {
   switch (s) {
     case device_state::init:
       return "init";
@@ -2,10 +2,51 @@
 #include "mqtt_event_handler.h"
 
 namespace homie {
+
+// Kind of outbound message, in order of decreasing priority. The transport
+// may use it to order, coalesce or drop queued messages.
+enum class message_class : uint8_t {
+  // $state transitions, every message is delivered in order
+  state,
+  // property values, only the most recent payload of a topic matters
+  value,
+  // retained device/node/property attributes
+  metadata,
+  // $stats/*
+  stats,
+  // $log lines
+  log,
+};
+
+inline const char *enum_to_string(message_class s) {
+  switch (s) {
+    case message_class::state:
+      return "state";
+    case message_class::value:
+      return "value";
+    case message_class::metadata:
+      return "metadata";
+    case message_class::stats:
+      return "stats";
+    case message_class::log:
+      return "log";
+  }
+  return "unknown";
+}
+
 struct mqtt_client {
   virtual void set_event_handler(mqtt_event_handler *evt) = 0;
   virtual void open(const std::string &will_topic, const std::string &will_payload, int will_qos, bool will_retain) = 0;
-  virtual void publish(std::string topic, std::string payload, int qos, bool retain) = 0;
+  // topic and payload are only used during the call
+  virtual void publish(std::string_view topic, std::string_view payload, int qos, bool retain,
+                       message_class type) = 0;
+  // Hands a value straight to the transport when nothing is queued ahead of it,
+  // topic and payload are only used during the call. Returns false when the
+  // message has to go through publish() instead.
+  virtual bool publish_now(std::string_view topic, std::string_view payload, int qos,
+                           bool retain) {
+    return false;
+  }
   virtual void subscribe(const std::string &topic, int qos) = 0;
   virtual void unsubscribe(const std::string &topic) = 0;
   virtual bool is_connected() const = 0;
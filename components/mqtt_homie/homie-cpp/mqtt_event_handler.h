@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 
 namespace homie {
 struct mqtt_event_handler {
@@ -12,5 +13,7 @@ struct mqtt_event_handler {
   // Unexpected connection loss
   virtual void on_offline() = 0;
   virtual void on_message(const std::string &topic, const std::string &payload) = 0;
+  // A queued property value was handed to the broker connection
+  virtual void on_published(std::string_view topic, std::string_view payload) {}
 };
 }  // namespace homie
\ No newline at end of file
@@ -1,26 +1,43 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
-#include <set>
-#include <map>
 #include "property.h"
 
 namespace homie {
 
 struct node {
   static constexpr auto TAG = "homie:node";
-  virtual std::string get_id() const = 0;
-  virtual std::string get_name() const = 0;
+  // Descriptor accessors return views of storage owned by the node,
+  // they must stay valid for the lifetime of the node
+  virtual std::string_view get_id() const = 0;
+  virtual std::string_view get_name() const = 0;
   virtual std::string get_name(int64_t node_idx) const = 0;
-  virtual std::string get_type() const = 0;
+  virtual std::string_view get_type() const = 0;
   virtual bool is_array() const = 0;
   virtual std::pair<int64_t, int64_t> array_range() const = 0;
-  virtual std::set<std::string> get_properties() const = 0;
-  virtual const_property_ptr get_property(const std::string &id) const = 0;
-  virtual property_ptr get_property(const std::string &id) = 0;
 
-  virtual std::map<std::string, std::string> get_attributes() const = 0;
-  virtual std::map<std::string, std::string> get_attributes(int64_t node_idx) const { return get_attributes(); }
+  // Properties are enumerated by index in 0..get_property_count()-1, ordered by id
+  virtual size_t get_property_count() const = 0;
+  virtual const_property_ptr get_property_at(size_t index) const = 0;
+  virtual property_ptr get_property_at(size_t index) = 0;
+  virtual const_property_ptr get_property(std::string_view id) const = 0;
+  virtual property_ptr get_property(std::string_view id) = 0;
+
+  // Calls visitor with every additional attribute (key, value) of the node
+  virtual void for_each_attribute(attribute_visitor visitor) const = 0;
+
+  // Precomputed $properties payload, empty when it has to be built from the properties
+  virtual std::string_view get_property_list() const { return {}; }
+
+  void for_each_property(utils::function_ref<void(const_property_ptr)> visitor) const {
+    for (size_t i = 0, count = get_property_count(); i < count; ++i)
+      visitor(get_property_at(i));
+  }
+  void for_each_property(utils::function_ref<void(property_ptr)> visitor) {
+    for (size_t i = 0, count = get_property_count(); i < count; ++i)
+      visitor(get_property_at(i));
+  }
 };
 
 typedef node *node_ptr;
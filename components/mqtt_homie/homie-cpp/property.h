@@ -1,26 +1,46 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
 #include "datatype.h"
+#include "typed_value.h"
+#include "utils.h"
 
 namespace homie {
 
+// Receives (key, value) of an attribute, both are valid only during the call
+using attribute_visitor = utils::function_ref<void(std::string_view, std::string_view)>;
+
 struct property {
   static constexpr auto TAG = "homie:property";
-  virtual std::string get_id() const = 0;
-  virtual std::string get_name() const = 0;
+  // Descriptor accessors return views of storage owned by the property
+  // (usually static), they must stay valid for the lifetime of the property
+  virtual std::string_view get_id() const = 0;
+  virtual std::string_view get_name() const = 0;
   virtual bool is_settable() const = 0;
   virtual bool is_retained() const = 0;
-  virtual std::string get_unit() const = 0;
+  virtual std::string_view get_unit() const = 0;
   virtual datatype get_datatype() const = 0;
-  virtual std::string get_format() const = 0;
+  virtual std::string_view get_format() const = 0;
 
   virtual std::string get_value(int64_t node_idx) const = 0;
   virtual void set_value(int64_t node_idx, const std::string &value) = 0;
   virtual std::string get_value() const = 0;
   virtual void set_value(const std::string &value) = 0;
+  // Writes the current value into buffer and returns its length, returns 0 when
+  // the property only implements get_value()
+  virtual size_t format_value(char *buffer, size_t size) const { return 0; }
+
+  // Calls visitor with every additional attribute (key, value) of the property
+  virtual void for_each_attribute(attribute_visitor visitor) const = 0;
+
+  // Precomputed "<node>/<property>" topic suffix, empty when it has to be built
+  virtual std::string_view get_topic_suffix() const { return {}; }
 
-  virtual std::map<std::string, std::string> get_attributes() const = 0;
+  // Typed fast path for set commands, see typed_value. Properties that do not
+  // implement it return false and are handled through get_value()/set_value().
+  virtual bool get_typed_value(typed_value &value) const { return false; }
+  virtual bool set_typed_value(const typed_value &value) { return false; }
 };
 
 typedef property *property_ptr;
@@ -0,0 +1,209 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include "datatype.h"
+
+namespace homie {
+
+// Property value in its native form, see datatype
+struct typed_value {
+  datatype type = datatype::string;
+  union {
+    bool boolean;
+    int64_t integer;
+    double number;
+    // position of the value in the enum $format
+    uint32_t enum_index;
+    // r,g,b or h,s,v depending on $format
+    int32_t color[3];
+  };
+
+  typed_value() : integer(0) {}
+
+  static typed_value make_boolean(bool v) {
+    typed_value r;
+    r.type = datatype::boolean;
+    r.boolean = v;
+    return r;
+  }
+  static typed_value make_integer(int64_t v) {
+    typed_value r;
+    r.type = datatype::integer;
+    r.integer = v;
+    return r;
+  }
+  static typed_value make_number(double v) {
+    typed_value r;
+    r.type = datatype::number;
+    r.number = v;
+    return r;
+  }
+  static typed_value make_enum(uint32_t index) {
+    typed_value r;
+    r.type = datatype::enumeration;
+    r.enum_index = index;
+    return r;
+  }
+
+  bool operator==(const typed_value &other) const {
+    if (type != other.type)
+      return false;
+    switch (type) {
+      case datatype::boolean:
+        return boolean == other.boolean;
+      case datatype::integer:
+        return integer == other.integer;
+      case datatype::number:
+        return number == other.number;
+      case datatype::enumeration:
+        return enum_index == other.enum_index;
+      case datatype::color:
+        return color[0] == other.color[0] && color[1] == other.color[1] &&
+               color[2] == other.color[2];
+      case datatype::string:
+        break;
+    }
+    return false;
+  }
+  bool operator!=(const typed_value &other) const { return !(*this == other); }
+};
+
+// Property $format parsed once, used to validate and parse set payloads
+class compiled_format {
+ public:
+  compiled_format() = default;
+  compiled_format(datatype type, const std::string &format) : type(type) {
+    switch (type) {
+      case datatype::integer:
+      case datatype::number: {
+        auto sep = format.find(':');
+        if (sep == std::string::npos)
+          break;
+        has_range = parse_number(std::string_view(format).substr(0, sep), min) &&
+                    parse_number(std::string_view(format).substr(sep + 1), max);
+        break;
+      }
+      case datatype::enumeration: {
+        std::string_view rest = format;
+        while (true) {
+          auto pos = rest.find(',');
+          enum_values.emplace_back(rest.substr(0, pos));
+          if (pos == std::string_view::npos)
+            break;
+          rest.remove_prefix(pos + 1);
+        }
+        break;
+      }
+      case datatype::color:
+        hsv = format == "hsv";
+        break;
+      default:
+        break;
+    }
+  }
+
+  datatype get_type() const { return type; }
+
+  // Parses and validates payload, returns false when it is not a valid value
+  bool parse(std::string_view payload, typed_value &out) const {
+    switch (type) {
+      case datatype::boolean:
+        if (payload == "true") {
+          out = typed_value::make_boolean(true);
+          return true;
+        }
+        if (payload == "false") {
+          out = typed_value::make_boolean(false);
+          return true;
+        }
+        return false;
+
+      case datatype::integer: {
+        int64_t v;
+        if (!parse_integer(payload, v) || (has_range && (v < min || v > max)))
+          return false;
+        out = typed_value::make_integer(v);
+        return true;
+      }
+
+      case datatype::number: {
+        double v;
+        if (!parse_number(payload, v) || (has_range && (v < min || v > max)))
+          return false;
+        out = typed_value::make_number(v);
+        return true;
+      }
+
+      case datatype::enumeration:
+        for (size_t i = 0; i < enum_values.size(); ++i) {
+          if (enum_values[i] == payload) {
+            out = typed_value::make_enum(i);
+            return true;
+          }
+        }
+        return false;
+
+      case datatype::color: {
+        typed_value v;
+        v.type = datatype::color;
+        const int32_t limits[3] = {hsv ? 360 : 255, hsv ? 100 : 255, hsv ? 100 : 255};
+        for (int i = 0; i < 3; ++i) {
+          auto pos = payload.find(',');
+          if ((i < 2) == (pos == std::string_view::npos))
+            return false;
+          int64_t c;
+          if (!parse_integer(payload.substr(0, pos), c) || c < 0 || c > limits[i])
+            return false;
+          v.color[i] = static_cast<int32_t>(c);
+          payload.remove_prefix(i < 2 ? pos + 1 : payload.size());
+        }
+        out = v;
+        return true;
+      }
+
+      case datatype::string:
+        break;
+    }
+    return false;
+  }
+
+ private:
+  datatype type = datatype::string;
+  bool has_range = false;
+  bool hsv = false;
+  double min = 0;
+  double max = 0;
+  std::vector<std::string> enum_values;
+
+  // strto* need a terminated string, payloads are short so copy them to the stack
+  static bool copy_terminated(std::string_view s, char (&buf)[32]) {
+    if (s.empty() || s.size() >= sizeof(buf))
+      return false;
+    s.copy(buf, s.size());
+    buf[s.size()] = '\0';
+    return true;
+  }
+
+  static bool parse_integer(std::string_view s, int64_t &out) {
+    char buf[32];
+    if (!copy_terminated(s, buf))
+      return false;
+    char *end = nullptr;
+    out = std::strtoll(buf, &end, 10);
+    return end == buf + s.size();
+  }
+
+  static bool parse_number(std::string_view s, double &out) {
+    char buf[32];
+    if (!copy_terminated(s, buf))
+      return false;
+    char *end = nullptr;
+    out = std::strtod(buf, &end);
+    return end == buf + s.size();
+  }
+};
+
+}  // namespace homie
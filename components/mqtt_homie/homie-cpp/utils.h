@@ -1,8 +1,103 @@
 #pragma once
 #include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
 
 namespace homie {
 	namespace utils {
+		// 32-bit FNV-1a hash, pass the previous result as hash to continue it
+		inline uint32_t fnv1a(std::string_view s, uint32_t hash = 2166136261u) {
+			for (unsigned char c : s) {
+				hash ^= c;
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+
+		// Splits a string into tokens without allocating, tokens refer to the input
+		class tokenizer {
+		public:
+			tokenizer(std::string_view s, char delim) : rest(s), delim(delim), done(false) {}
+
+			bool next(std::string_view& token) {
+				if (done)
+					return false;
+				auto pos = rest.find(delim);
+				token = rest.substr(0, pos);
+				if (pos == std::string_view::npos)
+					done = true;
+				else
+					rest.remove_prefix(pos + 1);
+				return true;
+			}
+
+		private:
+			std::string_view rest;
+			char delim;
+			bool done;
+		};
+
+		// Non-owning reference to a callable, does not allocate. The referenced
+		// callable must outlive the function_ref, so use it only for parameters.
+		template<typename Signature>
+		class function_ref;
+
+		template<typename Ret, typename... Args>
+		class function_ref<Ret(Args...)> {
+		public:
+			template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, function_ref>>>
+			function_ref(F&& f)
+				: obj(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+				  call([](void* obj, Args... args) -> Ret {
+					  return (*static_cast<std::remove_reference_t<F>*>(obj))(std::forward<Args>(args)...);
+				  }) {}
+
+			Ret operator()(Args... args) const { return call(obj, std::forward<Args>(args)...); }
+
+		private:
+			void* obj;
+			Ret (*call)(void*, Args...);
+		};
+
+		// joins parts into a single string with one allocation
+		inline std::string concat(std::initializer_list<std::string_view> parts) {
+			size_t size = 0;
+			for (auto& part : parts)
+				size += part.size();
+			std::string r;
+			r.reserve(size);
+			for (auto& part : parts)
+				r.append(part);
+			return r;
+		}
+
+		// appends s as a quoted JSON string
+		inline void append_json_string(std::string& out, std::string_view s) {
+			static constexpr char hex[] = "0123456789abcdef";
+			out += '"';
+			for (char c : s) {
+				switch (c) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20) {
+						out += "\\u00";
+						out += hex[(c >> 4) & 0xf];
+						out += hex[c & 0xf];
+					} else {
+						out += c;
+					}
+				}
+			}
+			out += '"';
+		}
+
 		// split string
 		template<typename StringType = std::string>
 		inline std::vector<StringType> split(const StringType& s, const StringType& delim, size_t offset = 0, size_t max = std::numeric_limits<size_t>::max()) {
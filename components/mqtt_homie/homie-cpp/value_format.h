@@ -0,0 +1,99 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace homie {
+
+// Formatting of numeric payloads into caller provided buffers, nothing is
+// allocated. All functions write a terminated string and return its length,
+// or 0 when the buffer is too small.
+
+// large enough for any value produced below
+constexpr size_t value_buffer_size = 32;
+
+inline size_t format_unsigned(char *buffer, size_t size, uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  if (count + 1 > size)
+    return 0;
+  for (size_t i = 0; i < count; ++i)
+    buffer[i] = digits[count - 1 - i];
+  buffer[count] = '\0';
+  return count;
+}
+
+inline size_t format_integer(char *buffer, size_t size, int64_t value) {
+  if (value >= 0)
+    return format_unsigned(buffer, size, static_cast<uint64_t>(value));
+  if (size < 2)
+    return 0;
+  buffer[0] = '-';
+  // negate in unsigned arithmetic, INT64_MIN has no positive counterpart
+  const size_t length =
+      format_unsigned(buffer + 1, size - 1, ~static_cast<uint64_t>(value) + 1);
+  return length != 0 ? length + 1 : 0;
+}
+
+// Fixed number of decimals like printf("%.*f"); negative accuracy rounds to
+// tens, hundreds, ... like ESPHome's value_accuracy_to_string()
+inline size_t format_fixed(char *buffer, size_t size, double value, int accuracy) {
+  if (!std::isfinite(value)) {
+    const char *text = std::isnan(value) ? "nan" : value > 0 ? "inf" : "-inf";
+    const size_t length = std::strlen(text);
+    if (length + 1 > size)
+      return 0;
+    std::memcpy(buffer, text, length + 1);
+    return length;
+  }
+
+  if (accuracy <= 0) {
+    double factor = 1;
+    for (int i = accuracy; i < 0; ++i)
+      factor *= 10;
+    const double rounded = std::nearbyint(value / factor) * factor;
+    if (std::fabs(rounded) < 9e18)
+      return format_integer(buffer, size, static_cast<int64_t>(rounded));
+  } else if (accuracy <= 9) {
+    uint64_t scale = 1;
+    for (int i = 0; i < accuracy; ++i)
+      scale *= 10;
+    const double scaled = std::nearbyint(std::fabs(value) * static_cast<double>(scale));
+    // keep the integer part exact
+    if (scaled < 9e15) {
+      const auto digits = static_cast<uint64_t>(scaled);
+      size_t length = 0;
+      if (value < 0 && digits != 0) {
+        if (size < 2)
+          return 0;
+        buffer[length++] = '-';
+      }
+      const size_t integral = format_unsigned(buffer + length, size - length, digits / scale);
+      if (integral == 0)
+        return 0;
+      length += integral;
+      if (length + 1 + accuracy + 1 > size)
+        return 0;
+      buffer[length++] = '.';
+      uint64_t fraction = digits % scale;
+      for (int i = accuracy; i-- > 0;) {
+        buffer[length + i] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+      }
+      length += accuracy;
+      buffer[length] = '\0';
+      return length;
+    }
+  }
+
+  // out of the exact range, rare enough to leave to printf
+  const int length = std::snprintf(buffer, size, "%.*f", accuracy > 0 ? accuracy : 0, value);
+  return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+}  // namespace homie
@@ -1,15 +1,16 @@
 #include "homie_client.h"
 #include "homie_node.h"
 #include "homie_device.h"
+#include "outbound_queue.h"
 #include "esphome/core/application.h"
 #include "esphome/components/network/util.h"
 
+#include <algorithm>
+
 #ifdef USE_LOGGER
 #include "esphome/components/logger/logger.h"
 #endif
 
-#include <deque>
-
 #define TAG "homie:client"
 
 namespace esphome::mqtt_homie {
@@ -24,18 +25,38 @@ class MqttProxy : public homie::mqtt_client {
 
   void open(const std::string &will_topic, const std::string &will_payload, int will_qos,
             bool will_retain) override {}
-  void publish(std::string topic, std::string payload, int qos, bool retain) override {
-    m_outbound_queue.emplace_back(esphome::mqtt::MQTTMessage{
-        .topic = std::move(topic),
-        .payload = std::move(payload),
-        .qos = static_cast<uint8_t>(qos),
-        .retain = retain,
-    });
+  void publish(std::string_view topic, std::string_view payload, int qos, bool retain,
+               homie::message_class type) override {
+    m_outbound_queue.push(type, topic, payload, static_cast<uint8_t>(qos), retain,
+                          m_tracer ? m_tracer->current() : TraceStamp{});
+    if (m_proxy.publisher)
+      m_proxy.publisher->wake();
+  }
+  bool publish_now(std::string_view topic, std::string_view payload, int qos,
+                   bool retain) override {
+    // the publisher task sends from the queue, never while holding its mutex
+    if (m_proxy.publisher)
+      return false;
+    // keep order and priority of queued messages and the per loop budget
+    if (!m_outbound_queue.empty() || !m_client->is_connected())
+      return false;
+    if (m_max_messages != 0 && m_direct_sent >= m_max_messages)
+      return false;
+    m_topic_buffer.assign(topic.data(), topic.size());
+    if (!send(payload, static_cast<uint8_t>(qos), retain))
+      return false;
+    if (m_stats)
+      m_stats->on_sent(topic.size() + payload.size());
+    if (m_tracer)
+      m_tracer->on_sent(m_tracer->current(), micros());
+    ++m_direct_sent;
+    return true;
   }
   void subscribe(const std::string &topic, int qos) override {
     m_client->subscribe(
         topic,
         [this](const std::string &topic, const std::string &payload) {
+          auto lock = lock_publisher(m_proxy.publisher);
           if (m_proxy.handler)
             m_proxy.handler->on_message(topic, payload);
         },
@@ -44,51 +65,140 @@ class MqttProxy : public homie::mqtt_client {
   void unsubscribe(const std::string &topic) override { m_client->unsubscribe(topic); }
   bool is_connected() const override { return m_client->is_connected(); }
 
-  void check_outbound_queue() {
-    if (m_outbound_queue.empty()) {
-      return;
-    }
+  // Limits for a single check_outbound_queue() call, 0 means no limit
+  void set_budget(uint32_t max_messages, uint32_t time_slice_us) {
+    m_max_messages = max_messages;
+    m_time_slice_us = time_slice_us;
+  }
+
+  OutboundQueue &get_outbound_queue() { return m_outbound_queue; }
+  // MQTT callbacks arrive on the main loop and lock out the publisher task
+  void set_publisher(PublisherTask *publisher) { m_proxy.publisher = publisher; }
+  void set_runtime_stats(RuntimeStats *stats) { m_stats = stats; }
+  void set_latency_tracer(LatencyTracer *tracer) { m_tracer = tracer; }
+
+  // Sends queued messages within the budget, returns true while messages are
+  // left. With a publisher task the mutex is only held while a message is
+  // taken from and removed from the queue, the send itself runs without it.
+  bool check_outbound_queue() {
+    m_direct_sent = 0;
+    const uint32_t start_us = micros();
+    uint32_t sent = 0;
+    while (true) {
+      OutboundMessage message;
+      {
+        auto lock = lock_publisher(m_proxy.publisher);
+        if (m_outbound_queue.empty())
+          return false;
+        message = m_outbound_queue.front();
+        m_topic_buffer.assign(message.topic.data(), message.topic.size());
+        message.topic = m_topic_buffer;
+        if (m_proxy.publisher) {
+          // the queue may replace or evict the message during the send
+          m_payload_buffer.assign(message.payload.data(), message.payload.size());
+          message.payload = m_payload_buffer;
+        }
+      }
+
+      const bool delivered = send(message.payload, message.qos, message.retain);
+      auto lock = lock_publisher(m_proxy.publisher);
+      if (!delivered && m_client->is_connected()) {
+        // client cannot take more right now, retry in next loop unless it
+        // keeps refusing this message (too large, out of memory)
+        if (message.type != m_refused_type || message.id != m_refused_id) {
+          m_refused_type = message.type;
+          m_refused_id = message.id;
+          m_refused_attempts = 0;
+        }
+        if (++m_refused_attempts < MAX_SEND_ATTEMPTS)
+          return true;
+        ESP_LOGW(TAG, "Dropping message to %.*s after %" PRIu32 " attempts",
+                 static_cast<int>(message.topic.size()), message.topic.data(), MAX_SEND_ATTEMPTS);
+      }
+      m_refused_attempts = 0;
+      if (!delivered) {
+        // refused for good or disconnected
+        m_outbound_queue.drop(message);
+      } else {
+        if (m_stats)
+          m_stats->on_sent(message.topic.size() + message.payload.size());
+        if (m_tracer)
+          m_tracer->on_sent(message.trace, micros());
+        // a replaced message is not the last value any more, the newer one is
+        if (message.type == homie::message_class::value && m_proxy.handler &&
+            m_outbound_queue.is_front(message))
+          m_proxy.handler->on_published(message.topic, message.payload);
+        m_outbound_queue.pop(message);
+      }
 
-    m_client->publish(m_outbound_queue.front());
-    m_outbound_queue.pop_front();
-    if (m_outbound_queue.empty()) {
-      m_outbound_queue.shrink_to_fit();
+      if (m_max_messages != 0 && ++sent >= m_max_messages)
+        return !m_outbound_queue.empty();
+      if (m_time_slice_us != 0 && micros() - start_us >= m_time_slice_us)
+        return !m_outbound_queue.empty();
     }
   }
 
  private:
+  // topic has to be in m_topic_buffer, which keeps its capacity, so after the
+  // first publish of the longest topic filling it is a plain copy
+  bool send(std::string_view payload, uint8_t qos, bool retain) {
+    return m_client->publish(m_topic_buffer, payload.data(), payload.size(), qos, retain);
+  }
+
   esphome::mqtt::MQTTClientComponent *m_client = nullptr;
+  RuntimeStats *m_stats = nullptr;
+  LatencyTracer *m_tracer = nullptr;
+  uint32_t m_max_messages = 1;
+  uint32_t m_time_slice_us = 0;
+  // messages published by publish_now() since the last check_outbound_queue()
+  uint32_t m_direct_sent = 0;
+  // loops the message at the head of the queue may be refused by a connected
+  // client before it is dropped
+  static constexpr uint32_t MAX_SEND_ATTEMPTS = 50;
+  // head message the client refused and how often
+  homie::message_class m_refused_type = homie::message_class::value;
+  uint32_t m_refused_id = 0;
+  uint32_t m_refused_attempts = 0;
+  std::string m_topic_buffer;
+  // payload of the message sent by the publisher task
+  std::string m_payload_buffer;
 
   class MqttToHomieProxy : public esphome::mqtt::MqttStateHandler {
    public:
     homie::mqtt_event_handler *handler = nullptr;
+    PublisherTask *publisher = nullptr;
     void on_connected() {
+      auto lock = lock_publisher(publisher);
       if (handler)
         handler->on_connect();
     }
     void on_closing() {
+      auto lock = lock_publisher(publisher);
       if (handler)
         handler->on_closing();
     }
     void on_closed() {
+      auto lock = lock_publisher(publisher);
       if (handler)
         handler->on_closed();
     }
     void on_offline() {
+      auto lock = lock_publisher(publisher);
       if (handler)
         handler->on_offline();
     }
   };
   MqttToHomieProxy m_proxy;
 
-  std::deque<esphome::mqtt::MQTTMessage> m_outbound_queue;
+  OutboundQueue m_outbound_queue;
 };
 
 HomieClient::HomieClient(mqtt::MQTTClientComponent *client) {
   m_mqtt_proxy = std::make_unique<MqttProxy>(client);
 }
 
-void HomieClient::start_homie(HomieDevice *device, std::string prefix, int qos, bool retained) {
+void HomieClient::start_homie(HomieDevice *device, std::string prefix, int qos, bool retained,
+                              homie::protocol protocol) {
   if (m_homie_client)
     return;
 
@@ -97,21 +207,117 @@ void HomieClient::start_homie(HomieDevice *device, std::string prefix, int qos,
   if (!prefix.empty() && prefix.back() != '/')
     prefix += "/";
 
-  m_homie_client = std::make_unique<homie::client>(*m_mqtt_proxy, device, prefix, qos, retained);
+  m_homie_client =
+      std::make_unique<homie::client>(*m_mqtt_proxy, device, prefix, qos, retained, protocol);
   device->set_client(m_homie_client.get());
+  m_homie_client->set_event_handler(device);
+  device->set_outbound_queue(&m_mqtt_proxy->get_outbound_queue());
+  device->set_log_forwarder(&m_log_forwarder);
+}
+
+void HomieClient::set_publish_budget(uint32_t max_messages, uint32_t time_slice_us) {
+  m_mqtt_proxy->set_budget(max_messages, time_slice_us);
+}
+
+void HomieClient::set_pool_size(size_t size) { m_pool_size = size; }
+
+void HomieClient::set_publisher_task(int core, int priority, uint32_t stack_size,
+                                     uint32_t interval_ms) {
+  m_publisher = std::make_unique<PublisherTask>(core, priority, stack_size);
+  m_publisher_interval_ms = interval_ms;
+}
+
+void HomieClient::set_extended_stats(bool enabled) {
+  m_runtime_stats.reset(enabled ? new RuntimeStats() : nullptr);
+}
+
+void HomieClient::set_latency_tracing(bool enabled) {
+  m_latency_tracer.reset(enabled ? new LatencyTracer() : nullptr);
+}
+
+void HomieClient::stop_publisher_task() {
+  m_mqtt_proxy->set_publisher(nullptr);
+  if (m_device)
+    m_device->set_publisher(nullptr);
+  m_publisher.reset();
+}
+
+void HomieClient::configure_queue(homie::message_class type, size_t max_bytes,
+                                  OverflowPolicy policy) {
+  m_mqtt_proxy->get_outbound_queue().configure(type, max_bytes, policy);
 }
 
 void HomieClient::setup() {
+  // lanes are configured and the device topic known by now
+  m_mqtt_proxy->get_outbound_queue().reserve_pool(
+      m_pool_size, m_homie_client ? m_homie_client->get_device_topic().size() : 0);
 #ifdef USE_LOGGER
   logger::global_logger->add_on_log_callback(
       [this](int level, const char *tag, const char *message) {
-        if (level <= this->m_log_level) {
-          m_device->push_log_message(level, tag, message);
-        }
+        if (m_log_forwarder.push(level, tag, message) && m_publisher)
+          m_publisher->wake();
       });
 #endif
+  if (m_publisher) {
+    m_mqtt_proxy->set_publisher(m_publisher.get());
+    if (m_device)
+      m_device->set_publisher(m_publisher.get());
+  }
+  m_mqtt_proxy->set_runtime_stats(m_runtime_stats.get());
+  m_mqtt_proxy->set_latency_tracer(m_latency_tracer.get());
+  if (m_device) {
+    m_device->set_runtime_stats(m_runtime_stats.get());
+    m_device->set_latency_tracer(m_latency_tracer.get());
+  }
+}
+
+void HomieClient::loop() {
+  if (!m_publisher) {
+    run_pass();
+    return;
+  }
+  // every setup() has run, from now on the task does the work
+  if (!m_publisher->is_running() && !m_publisher->start([this] { return run_pass(); })) {
+    ESP_LOGW(TAG, "Publishing from the main loop");
+    stop_publisher_task();
+  }
+}
+
+uint32_t HomieClient::run_pass() {
+  const uint32_t start_us = m_runtime_stats ? micros() : 0;
+  uint32_t wait_ms = m_device ? m_device->process() : PublisherTask::IDLE;
+  // retry a busy client and continue a drain cut short by the budget
+  if (pump())
+    wait_ms = std::min(wait_ms, m_publisher_interval_ms);
+  if (m_runtime_stats) {
+    auto lock = lock_publisher(m_publisher.get());
+    m_runtime_stats->on_loop(micros() - start_us);
+  }
+  return std::min(wait_ms, m_log_forwarder.flush_due_in(millis()));
 }
 
-void HomieClient::loop() { m_mqtt_proxy->check_outbound_queue(); }
+bool HomieClient::pump() {
+  auto *publisher = m_publisher.get();
+  // pull more metadata only when the previous batch has mostly left the
+  // queue, one step of the cursor per lock
+  auto &metadata = m_mqtt_proxy->get_outbound_queue().lane(homie::message_class::metadata);
+  bool device_info_pending = false;
+  for (size_t i = 0; i < DEVICE_INFO_BATCH; ++i) {
+    auto lock = lock_publisher(publisher);
+    device_info_pending = m_homie_client && m_homie_client->has_pending_device_info();
+    if (!device_info_pending || (i == 0 && metadata.size() >= DEVICE_INFO_BATCH))
+      break;
+    device_info_pending = m_homie_client->continue_device_info(1);
+  }
+  {
+    auto lock = lock_publisher(publisher);
+    m_log_forwarder.flush(millis(), [this](std::string_view batch) {
+      if (m_homie_client)
+        m_homie_client->publish_log_message(batch);
+    });
+  }
+  const bool queued = m_mqtt_proxy->check_outbound_queue();
+  return queued || device_info_pending;
+}
 
 }  // namespace esphome::mqtt_homie
@@ -13,6 +13,11 @@
 #include "homie-cpp.h"
 
 #include "esphome/components/mqtt/mqtt_client.h"
+#include "outbound_queue.h"
+#include "log_forwarder.h"
+#include "publisher_task.h"
+#include "runtime_stats.h"
+#include "latency_tracer.h"
 
 namespace esphome::mqtt_homie {
 
@@ -26,15 +31,51 @@ class HomieClient : public Component {
   HomieClient(mqtt::MQTTClientComponent *client);
 
   void set_update_interval(uint32_t) {}
-  void setup_logging(int level) { m_log_level = level; };
+  void setup_logging(int level) { m_log_forwarder.set_level(level); };
+  void configure_log(size_t buffer_size, uint32_t flush_interval_ms, uint32_t rate_per_s,
+                     uint32_t burst) {
+    m_log_forwarder.configure(buffer_size, flush_interval_ms, rate_per_s, burst);
+  }
+  void set_log_tag_level(std::string tag, int level) {
+    m_log_forwarder.set_tag_level(std::move(tag), level);
+  }
 
   void setup() override;
   void loop() override;
 
-  void start_homie(HomieDevice *device, std::string prefix, int qos, bool retained);
+  // number of metadata messages produced per loop while publishing device info
+  static constexpr size_t DEVICE_INFO_BATCH = 8;
+
+  void start_homie(HomieDevice *device, std::string prefix, int qos, bool retained,
+                   homie::protocol protocol = homie::protocol::v3);
+  void set_publish_budget(uint32_t max_messages, uint32_t time_slice_us);
+  void configure_queue(homie::message_class type, size_t max_bytes, OverflowPolicy policy);
+  // bytes reserved for queued message storage, see MessagePool
+  void set_pool_size(size_t size);
+  // Reports queue, publish rate, heap and loop time details in $stats
+  void set_extended_stats(bool enabled);
+  // Reports notify -> publish and set -> echo latency histograms in $stats
+  void set_latency_tracing(bool enabled);
+  // Moves the work of this and the device loop into a PublisherTask. It runs
+  // when woken by a change and every interval_ms only while messages wait.
+  void set_publisher_task(int core, int priority, uint32_t stack_size, uint32_t interval_ms);
 
  protected:
-  int m_log_level = ESPHOME_LOG_LEVEL_NONE;
+  // device info batches, log flushes and the outbound queue drain, returns
+  // true while messages or device info are left over
+  bool pump();
+  // One pass of the publishing work, device processing and pump(), timed for
+  // the loop stats. Runs in loop() or on the publisher task, returns the
+  // milliseconds until the task has to run it again.
+  uint32_t run_pass();
+  void stop_publisher_task();
+
+  LogForwarder m_log_forwarder;
+  size_t m_pool_size = 0;
+  std::unique_ptr<PublisherTask> m_publisher;
+  uint32_t m_publisher_interval_ms = 0;
+  std::unique_ptr<RuntimeStats> m_runtime_stats;
+  std::unique_ptr<LatencyTracer> m_latency_tracer;
   HomieDevice *m_device = nullptr;
   std::unique_ptr<homie::client> m_homie_client;
   std::unique_ptr<MqttProxy> m_mqtt_proxy;
@@ -5,12 +5,20 @@
 #include "esphome/core/automation.h"
 #include "esphome/core/log.h"
 
+#include <algorithm>
 #include <vector>
 #include <memory>
+#include <cinttypes>
+#include <cstring>
 
 #include "homie_device.h"
 #include "homie_node.h"
 #include "device_info.h"
+#include "outbound_queue.h"
+#include "log_forwarder.h"
+#include "publisher_task.h"
+#include "runtime_stats.h"
+#include "latency_tracer.h"
 
 #include "esphome/core/application.h"
 #include "esphome/core/version.h"
@@ -30,73 +38,273 @@ constexpr uint8_t MakeStateTransition(homie::device_state from, homie::device_st
 const std::string &HomieDevice::get_id() const { return App.get_name(); }
 const std::string &HomieDevice::get_name() const { return App.get_friendly_name(); }
 
-std::set<std::string> HomieDevice::get_nodes() const {
-  std::set<std::string> r;
-  for (auto &node : m_nodes)
-    r.insert(node.first);
-  return r;
+std::vector<HomieNodeBase *>::const_iterator HomieDevice::find_node(std::string_view id) const {
+  return std::lower_bound(
+      m_nodes.begin(), m_nodes.end(), id,
+      [](const HomieNodeBase *node, std::string_view id) { return node->get_id() < id; });
 }
 
-homie::node_ptr HomieDevice::get_node(const std::string &id) {
-  if (auto it = m_nodes.find(id); it != m_nodes.end())
-    return it->second;
+homie::node_ptr HomieDevice::get_node_at(size_t index) { return m_nodes[index]; }
+
+homie::const_node_ptr HomieDevice::get_node_at(size_t index) const { return m_nodes[index]; }
+
+homie::node_ptr HomieDevice::get_node(std::string_view id) {
+  if (auto it = find_node(id); it != m_nodes.end() && (*it)->get_id() == id)
+    return *it;
   return nullptr;
 }
 
-homie::const_node_ptr HomieDevice::get_node(const std::string &id) const {
-  if (auto it = m_nodes.find(id); it != m_nodes.end())
-    return it->second;
+homie::const_node_ptr HomieDevice::get_node(std::string_view id) const {
+  if (auto it = find_node(id); it != m_nodes.end() && (*it)->get_id() == id)
+    return *it;
   return nullptr;
 }
 
 homie::device_state HomieDevice::get_state() const { return m_device_state; }
 
-std::map<std::string, std::string> HomieDevice::get_attributes() const {
-  const char *model = ESPHOME_VARIANT;
-  return {
-      {"mac", get_mac_address_pretty()},
-      {"localip", network::get_ip_addresses()[0].str()},
-
-      {"fw/name", "esphome"},
-      {"fw/version", ESPHOME_VERSION},
-      {"implementation", "esphome/homie-cpp"},
-
-      {"implementation/board", ESPHOME_BOARD},
-      {"implementation/board_variant", ESPHOME_VARIANT},
-      {"implementation/date", App.get_compilation_time()},
-      {"implementation/comment", App.get_comment()},
-      {"implementation/area", App.get_area()},
-      {"implementation/domain", network::get_use_address()},
-      {"implementation/framework", get_framework_name()},
-      {"implementation/cpu_speed", get_cpu_frequency()},
+std::string_view HomieDevice::get_node_list() const {
+  if (m_topology)
+    return m_topology->node_list;
+  return {};
+}
+
+void HomieDevice::for_each_attribute(homie::attribute_visitor visitor) const {
+  visitor("mac", get_mac_address_pretty());
+  visitor("localip", network::get_ip_addresses()[0].str());
+
+  visitor("fw/name", "esphome");
+  visitor("fw/version", ESPHOME_VERSION);
+  visitor("implementation", "esphome/homie-cpp");
+
+  visitor("implementation/board", ESPHOME_BOARD);
+  visitor("implementation/board_variant", ESPHOME_VARIANT);
+  visitor("implementation/date", App.get_compilation_time());
+  visitor("implementation/comment", App.get_comment());
+  visitor("implementation/area", App.get_area());
+  visitor("implementation/domain", network::get_use_address());
+  visitor("implementation/framework", get_framework_name());
+  visitor("implementation/cpu_speed", get_cpu_frequency());
 #ifdef HOMIE_DEVICE_INFO_CHIP_ID
-      {"implementation/chip_id", get_chip_id()},
+  visitor("implementation/chip_id", get_chip_id());
 #endif
 
-      {"stats/stats", "uptime,signal,freeheap"},
-      {"stats/interval", std::to_string(m_stat_update_interval / 1000)},
-  };
+  std::string stats = "uptime,signal,freeheap,"
+                      "dropped_state,dropped_value,dropped_metadata,dropped_stats,dropped_log,"
+                      "pool_size,pool_used,pool_peak,pool_fallback,skipped_value,log_suppressed";
+  if (m_runtime_stats) {
+    stats += ",queue_depth,queue_peak,queue_bytes,coalesced,sent_messages,sent_bytes,"
+             "loop_time,loop_time_max";
+#ifdef HOMIE_DEVICE_INFO_HEAP_DETAILS
+    stats += ",heap_largest,heap_min";
+#endif
+  }
+  if (m_latency_tracer) {
+    stats += ",notify_latency,notify_latency_max,set_latency,set_latency_max";
+    char limits[LatencyTracer::FORMAT_SIZE];
+    visitor("stats/latency_buckets",
+            std::string_view(limits, LatencyHistogram::format_limits(limits, sizeof(limits))));
+  }
+  visitor("stats/stats", stats);
+  visitor("stats/interval", std::to_string(m_stat_update_interval / 1000));
 }
 
-std::map<std::string, std::string> HomieDevice::get_stats() const {
-  auto rssi = wifi::global_wifi_component->wifi_rssi();
-  return {
-      {"uptime", std::to_string(get_uptime_seconds())},
-      {"signal", std::to_string(clamp(2 * (rssi + 100), 0, 100))},
-      {"signal_db", std::to_string(rssi)},
-      {"freeheap", get_free_heap()},
+void HomieDevice::for_each_stat(homie::attribute_visitor visitor) const {
+  char buffer[homie::value_buffer_size];
+  auto visit = [&visitor, &buffer](std::string_view key, int64_t value) {
+    visitor(key, std::string_view(buffer, homie::format_integer(buffer, sizeof(buffer), value)));
   };
+
+  const auto rssi = wifi::global_wifi_component->wifi_rssi();
+  visit("uptime", get_uptime_seconds());
+  visit("signal", clamp(2 * (rssi + 100), 0, 100));
+  visit("signal_db", rssi);
+  visit("freeheap", get_free_heap_size());
+  if (m_outbound_queue) {
+    // "dropped_" + longest message class name
+    char key[24] = "dropped_";
+    for (size_t i = 0; i < OutboundQueue::LANE_COUNT; ++i) {
+      const auto type = static_cast<homie::message_class>(i);
+      std::strncpy(key + 8, homie::enum_to_string(type), sizeof(key) - 9);
+      visit(key, m_outbound_queue->lane(type).dropped());
+    }
+    const auto &pool = m_outbound_queue->pool();
+    visit("pool_size", pool.capacity());
+    visit("pool_used", pool.used());
+    visit("pool_peak", pool.peak());
+    visit("pool_fallback", pool.fallbacks());
+  }
+  if (m_client)
+    visit("skipped_value", m_client->get_values_skipped());
+  if (m_log_forwarder)
+    visit("log_suppressed", m_log_forwarder->suppressed().total());
+
+  if (m_latency_tracer) {
+    // bucket counts since the previous report, see stats/latency_buckets
+    char histogram[LatencyTracer::FORMAT_SIZE];
+    const auto &notify = m_latency_tracer->notify();
+    visitor("notify_latency",
+            std::string_view(histogram, notify.format(histogram, sizeof(histogram))));
+    visit("notify_latency_max", notify.max_us());
+    const auto &set = m_latency_tracer->set();
+    visitor("set_latency", std::string_view(histogram, set.format(histogram, sizeof(histogram))));
+    visit("set_latency_max", set.max_us());
+  }
+
+  if (!m_runtime_stats)
+    return;
+  if (m_outbound_queue) {
+    visit("queue_depth", m_outbound_queue->size());
+    visit("queue_peak", m_outbound_queue->peak_size());
+    visit("queue_bytes", m_outbound_queue->bytes());
+    visit("coalesced", m_outbound_queue->coalesced());
+  }
+  // since the previous report
+  visit("sent_messages", m_runtime_stats->sent_messages);
+  visit("sent_bytes", m_runtime_stats->sent_bytes);
+  visit("loop_time", m_runtime_stats->loop_us_average());
+  visit("loop_time_max", m_runtime_stats->loop_us_max);
+#ifdef HOMIE_DEVICE_INFO_HEAP_DETAILS
+  visit("heap_largest", get_largest_free_block());
+  visit("heap_min", get_min_free_heap_size());
+#endif
+}
+
+void HomieDevice::publish_stats() {
+  m_client->update_device_stats();
+  // counters and histograms cover the time since the previous report
+  if (m_runtime_stats)
+    m_runtime_stats->reset();
+  if (m_latency_tracer)
+    m_latency_tracer->reset();
 }
 
 void HomieDevice::attach_node(HomieNodeBase *node) {
-  m_nodes[node->get_id()] = node;
-  node->attach_device(this);
+  auto it = find_node(node->get_id());
+  if (it != m_nodes.end() && (*it)->get_id() == node->get_id()) {
+    ESP_LOGW(TAG, "Duplicate node id '%s'", std::string(node->get_id()).c_str());
+    return;
+  }
+  m_nodes.insert(it, node);
+
+  const size_t first_slot = m_properties.size();
+  node->for_each_property([this](homie::property_ptr property) {
+    auto homie_property = static_cast<HomiePropertyBase *>(property);
+    homie_property->set_slot(m_properties.size());
+    m_properties.push_back(homie_property);
+  });
+  m_dirty_properties.resize((m_properties.size() + 31) / 32, 0);
+  m_forced_properties.resize(m_dirty_properties.size(), 0);
+  m_notifications.resize(m_properties.size());
+
+  node->attach_device(this, first_slot, m_properties.size() - first_slot);
+  if (node->has_publish_limits())
+    m_limited_nodes.push_back(node);
+  if (m_client)
+    m_client->invalidate_topics();
 }
 
-void HomieDevice::notify_node_changed(HomieNodeBase *node, HomiePropertyBase *property) {
-  if (m_client) {
-    m_client->notify_property_changed(node->get_id(), property->get_id());
+void HomieDevice::notify_node_changed(HomieNodeBase *node, HomiePropertyBase *property,
+                                      bool force) {
+  // may run on any task, only atomics are touched here
+  auto [first_slot, count] = node->get_property_slots();
+  uint8_t flags = force ? NOTIFY_FORCE : 0;
+  if (property) {
+    first_slot = property->get_slot();
+    count = 1;
+    flags |= NOTIFY_CHANGED;
+  } else {
+    flags |= NOTIFY_NODE;
+  }
+  if (!m_notify_times.empty()) {
+    const uint32_t now = micros();
+    for (size_t slot = first_slot; slot < first_slot + count && slot < m_notify_times.size();
+         ++slot) {
+      uint32_t none = 0;
+      m_notify_times[slot].compare_exchange_strong(none, now, std::memory_order_relaxed);
+    }
   }
+  m_notifications.set(first_slot, count, flags);
+  if (m_publisher)
+    m_publisher->wake();
+}
+
+void HomieDevice::receive_notifications(uint32_t now) {
+  m_notifications.take([this, now](size_t slot, uint8_t flags) {
+    if (slot >= m_properties.size())
+      return;
+    const uint32_t time_us =
+        slot < m_notify_times.size() ? m_notify_times[slot].exchange(0, std::memory_order_relaxed)
+                                     : 0;
+    const bool force = (flags & NOTIFY_FORCE) != 0;
+    // whole node notifications bypass the publish limits like forced ones
+    auto property = m_properties[slot];
+    if (force || (flags & NOTIFY_NODE) || property->get_parent()->accept_change(*property, now))
+      mark_dirty(slot, force, time_us);
+  });
+}
+
+void HomieDevice::mark_dirty(size_t slot, bool force, uint32_t time_us) {
+  if (slot >= m_properties.size())
+    return;
+  if (time_us != 0 && slot < m_trace_times.size() && m_trace_times[slot].notify_us == 0)
+    m_trace_times[slot].notify_us = time_us;
+  m_dirty_properties[slot / 32] |= 1u << (slot % 32);
+  if (force)
+    m_forced_properties[slot / 32] |= 1u << (slot % 32);
+  m_any_dirty = true;
+}
+
+void HomieDevice::flush_dirty_properties() {
+  if (!m_any_dirty || !m_client)
+    return;
+  m_any_dirty = false;
+
+  for (size_t word = 0; word < m_dirty_properties.size(); ++word) {
+    uint32_t bits = m_dirty_properties[word];
+    const uint32_t forced = m_forced_properties[word];
+    m_dirty_properties[word] = 0;
+    m_forced_properties[word] = 0;
+    while (bits != 0) {
+      const size_t bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+      auto property = m_properties[word * 32 + bit];
+      // per property, the main loop never waits for a whole flush
+      auto lock = lock_publisher(m_publisher);
+      if (m_latency_tracer)
+        m_latency_tracer->begin(take_trace_stamp(word * 32 + bit));
+      m_client->notify_property_changed(property->get_parent(), property,
+                                        (forced & (1u << bit)) != 0);
+      if (m_latency_tracer)
+        m_latency_tracer->end();
+    }
+  }
+}
+
+void HomieDevice::set_latency_tracer(LatencyTracer *tracer) {
+  m_latency_tracer = tracer;
+  m_trace_times.assign(tracer ? m_properties.size() : 0, TraceTimes{});
+  m_notify_times = std::vector<std::atomic<uint32_t>>(m_trace_times.size());
+}
+
+void HomieDevice::on_property_set(const homie::node *node, const homie::property *property) {
+  const size_t slot = static_cast<const HomiePropertyBase *>(property)->get_slot();
+  if (slot < m_trace_times.size())
+    m_trace_times[slot].set_us = micros();
+}
+
+TraceStamp HomieDevice::take_trace_stamp(size_t slot) {
+  if (slot >= m_trace_times.size())
+    return {};
+  auto &times = m_trace_times[slot];
+  TraceStamp stamp;
+  // a set that changed nothing leaves its stamp behind, a publish long after
+  // it is not its echo
+  if (times.set_us != 0 && micros() - times.set_us <= LatencyTracer::SET_ECHO_TIMEOUT_US)
+    stamp = {times.set_us, TraceStamp::SET};
+  else if (times.notify_us != 0)
+    stamp = {times.notify_us, TraceStamp::NOTIFY};
+  times = TraceTimes{};
+  return stamp;
 }
 
 void HomieDevice::goto_state(homie::device_state new_state) {
@@ -107,8 +315,8 @@ void HomieDevice::goto_state(homie::device_state new_state) {
   const auto prev_state = m_device_state;
   m_device_state = new_state;
 
-  ESP_LOGI(TAG, "State changed %s->%s", homie::enum_to_string(prev_state).c_str(),
-           homie::enum_to_string(new_state).c_str());
+  ESP_LOGI(TAG, "State changed %s->%s", homie::enum_to_string(prev_state),
+           homie::enum_to_string(new_state));
 
   m_client->notify_device_state_changed();
 
@@ -117,14 +325,23 @@ void HomieDevice::goto_state(homie::device_state new_state) {
   switch (transition) {
     case MakeStateTransition(device_state::init, device_state::ready):
     case MakeStateTransition(device_state::init, device_state::alert):
-      m_client->update_device_stats();
+      ESP_LOGD(TAG, "Device info: %zu retained messages, %zu bytes",
+               m_client->get_device_info_messages(), m_client->get_device_info_bytes());
+      store_metadata_digest();
+      publish_stats();
       m_client->start_subscription();
-      set_interval(gHomeStatTimerId, m_stat_update_interval,
-                   [this] { m_client->update_device_stats(); });
+      set_interval(gHomeStatTimerId, m_stat_update_interval, [this] {
+        auto lock = lock_publisher(m_publisher);
+        publish_stats();
+      });
       break;
 
     case MakeStateTransition(device_state::disconnected, device_state::init):
-      m_client->publish_device_info();
+      start_device_info();
+      break;
+
+    case MakeStateTransition(device_state::init, device_state::disconnected):
+      m_client->cancel_device_info();
       break;
 
     case MakeStateTransition(device_state::ready, device_state::disconnected):
@@ -159,6 +376,14 @@ void HomieDevice::check_device_state() {
     return;
   }
 
+  if (m_device_state == device_state::init) {
+    // stay in init until all metadata is published
+    if (m_client->has_pending_device_info())
+      return;
+    if (m_outbound_queue && !m_outbound_queue->lane(homie::message_class::metadata).empty())
+      return;
+  }
+
   const auto app_state = App.get_app_state();
 
   const auto led_status = app_state & STATUS_LED_MASK;
@@ -170,7 +395,76 @@ void HomieDevice::check_device_state() {
   goto_state(homie::device_state::ready);
 }
 
-void HomieDevice::setup() { goto_state(homie::device_state::disconnected); }
+void HomieDevice::start_device_info() {
+  if (!m_skip_unchanged_metadata) {
+    m_client->publish_device_info();
+    return;
+  }
+
+  m_pending_metadata_digest = m_client->compute_device_info_digest();
+  if (m_outbound_queue)
+    m_metadata_dropped = m_outbound_queue->lane(homie::message_class::metadata).dropped();
+
+  const bool unchanged = m_pending_metadata_digest == m_published_metadata_digest;
+  ESP_LOGD(TAG, "Metadata digest %08" PRIx32 " %s", m_pending_metadata_digest,
+           unchanged ? "unchanged, publishing values only" : "changed");
+  m_client->publish_device_info(unchanged);
+}
+
+void HomieDevice::store_metadata_digest() {
+  if (!m_skip_unchanged_metadata || m_pending_metadata_digest == m_published_metadata_digest)
+    return;
+  if (m_outbound_queue &&
+      m_outbound_queue->lane(homie::message_class::metadata).dropped() != m_metadata_dropped) {
+    // some metadata never reached the broker, publish everything next time
+    return;
+  }
+  m_published_metadata_digest = m_pending_metadata_digest;
+  m_metadata_pref.save(&m_published_metadata_digest);
+}
+
+bool HomieDevice::apply_topology() {
+  if (m_topology->node_count != m_nodes.size() ||
+      m_topology->property_count != m_properties.size())
+    return false;
+
+  for (size_t i = 0; i < m_nodes.size(); ++i) {
+    const auto &node = m_topology->nodes[i];
+    if (m_nodes[i]->get_id() != node.id || m_nodes[i]->get_property_count() != node.property_count)
+      return false;
+    for (size_t j = 0; j < node.property_count; ++j) {
+      if (m_nodes[i]->get_property_at(j)->get_id() !=
+          m_topology->properties[node.first_property + j].id)
+        return false;
+    }
+  }
+
+  for (size_t i = 0; i < m_nodes.size(); ++i) {
+    const auto &node = m_topology->nodes[i];
+    m_nodes[i]->set_topology_id(node.id);
+    m_nodes[i]->set_property_list(node.properties);
+    for (size_t j = 0; j < node.property_count; ++j) {
+      auto property = static_cast<HomiePropertyBase *>(m_nodes[i]->get_property_at(j));
+      property->set_topic_suffix(m_topology->properties[node.first_property + j].topic_suffix);
+    }
+  }
+  return true;
+}
+
+void HomieDevice::setup() {
+  if (m_topology && !apply_topology()) {
+    ESP_LOGW(TAG, "Generated topology does not match attached nodes, ignoring it");
+    m_topology = nullptr;
+  } else if (m_topology && m_client) {
+    m_client->invalidate_topics();
+  }
+  if (m_skip_unchanged_metadata) {
+    m_metadata_pref = global_preferences->make_preference<uint32_t>(fnv1_hash("homie_metadata"));
+    if (!m_metadata_pref.load(&m_published_metadata_digest))
+      m_published_metadata_digest = 0;
+  }
+  goto_state(homie::device_state::disconnected);
+}
 
 uint64_t HomieDevice::get_uptime_seconds() const {
   const uint32_t ms = millis();
@@ -186,10 +480,35 @@ uint64_t HomieDevice::get_uptime_seconds() const {
   return this->m_uptime_ms / 1000ULL;
 }
 
-void HomieDevice::update() { check_device_state(); }
+void HomieDevice::loop() {
+  // State transitions subscribe, start timers and save preferences, they stay
+  // on the main loop even with a publisher task. init ends as soon as all
+  // metadata has left the queue.
+  if (m_state_check_pending || m_device_state == homie::device_state::init) {
+    // while the task holds the mutex the check waits for the next pass
+    std::unique_lock<Mutex> lock;
+    if (try_lock_publisher(m_publisher, lock)) {
+      m_state_check_pending = false;
+      check_device_state();
+    }
+  }
+}
+
+uint32_t HomieDevice::process() {
+  const uint32_t now = millis();
+  receive_notifications(now);
+  // due heartbeats and held back changes come back as notifications in the
+  // next pass, the task is woken for them
+  uint32_t due_ms = UINT32_MAX;
+  for (auto *node : m_limited_nodes)
+    due_ms = std::min(due_ms, node->check_publish_limits(now));
+  flush_dirty_properties();
+  return due_ms;
+}
 
-void HomieDevice::push_log_message(int level, const char *tag, const char *message) const {
-  m_client->publish_log_message(message);
+void HomieDevice::update() {
+  auto lock = lock_publisher(m_publisher);
+  check_device_state();
 }
 
 }  // namespace esphome::mqtt_homie
\ No newline at end of file
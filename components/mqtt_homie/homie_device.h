@@ -2,20 +2,32 @@
 
 #include "esphome/core/defines.h"
 #include "esphome/core/controller.h"
+#include "esphome/core/preferences.h"
 
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <map>
 
 #include "homie-cpp.h"
+#include "homie_topology.h"
+#include "pending_slots.h"
 
 namespace esphome {
 namespace mqtt_homie {
 
 class HomieNodeBase;
 class HomiePropertyBase;
-
-class HomieDevice : public ::homie::device, public PollingComponent {
+class OutboundQueue;
+class LogForwarder;
+class PublisherTask;
+struct RuntimeStats;
+class LatencyTracer;
+struct TraceStamp;
+
+class HomieDevice : public ::homie::device,
+                    public ::homie::client_event_handler,
+                    public PollingComponent {
  public:
   static constexpr auto TAG = "homie:device";
 
@@ -24,37 +36,122 @@ class HomieDevice : public ::homie::device, public PollingComponent {
   const std::string &get_id() const override;
   const std::string &get_name() const override;
 
-  std::set<std::string> get_nodes() const override;
-  homie::node_ptr get_node(const std::string &id) override;
-  homie::const_node_ptr get_node(const std::string &id) const override;
+  size_t get_node_count() const override { return m_nodes.size(); }
+  homie::node_ptr get_node_at(size_t index) override;
+  homie::const_node_ptr get_node_at(size_t index) const override;
+  homie::node_ptr get_node(std::string_view id) override;
+  homie::const_node_ptr get_node(std::string_view id) const override;
 
   homie::device_state get_state() const override;
-  std::map<std::string, std::string> get_attributes() const override;
-  std::map<std::string, std::string> get_stats() const override;
+  void for_each_attribute(homie::attribute_visitor visitor) const override;
+  std::string_view get_node_list() const override;
+  void for_each_stat(homie::attribute_visitor visitor) const override;
 
   void attach_node(HomieNodeBase *node);
-  void notify_node_changed(HomieNodeBase *node, HomiePropertyBase *property);
+  // Topology generated at compile time, verified against attached nodes in setup()
+  void set_topology(const HomieTopology *topology) { m_topology = topology; }
+  // Marks property (or all node properties when property is null) to be published
+  // in the next loop. Safe from any task, never blocks or allocates. With force set
+  // the value is published even when it equals the last published one.
+  // Publish limits of the node are applied by process().
+  void notify_node_changed(HomieNodeBase *node, HomiePropertyBase *property, bool force = false);
   void set_client(homie::client *client) { m_client = client; }
+  void set_outbound_queue(const OutboundQueue *queue) { m_outbound_queue = queue; }
+  void set_log_forwarder(const LogForwarder *forwarder) { m_log_forwarder = forwarder; }
+  // Extended stats, reported and reset on every $stats update
+  void set_runtime_stats(RuntimeStats *stats) { m_runtime_stats = stats; }
+  // Traces latencies of property publishes, reported and reset on every $stats update
+  void set_latency_tracer(LatencyTracer *tracer);
+  // With a publisher task, process() runs on the task and holds the task's
+  // mutex for one property at a time. State transitions always run in
+  // loop(), holding the mutex.
+  void set_publisher(PublisherTask *publisher) { m_publisher = publisher; }
 
   void setup() override;
+  void loop() override;
+  // Publish limits and publishing of changed properties, run by HomieClient
+  // in its loop or on the publisher task. Returns the milliseconds until a
+  // held back change or heartbeat is due, or UINT32_MAX.
+  uint32_t process();
+  // fallback, state changes are normally driven by on_connection_changed()
   void update() override;
 
+  void on_broadcast(const std::string &level, const std::string &payload) override {}
+  void on_connection_changed(bool connected) override { m_state_check_pending = true; }
+  void on_property_set(const homie::node *node, const homie::property *property) override;
+
   void set_stats_interval(int v) { m_stat_update_interval = v; }
+  // Republish only $state, values and $stats on reconnect when retained
+  // metadata did not change since it was last published
+  void set_skip_unchanged_metadata(bool v) { m_skip_unchanged_metadata = v; }
 
-  void push_log_message(int level, const char *tag, const char *message) const;
 
  private:
-  homie::client *m_client;
-  std::map<std::string, HomieNodeBase *> m_nodes;
+  homie::client *m_client = nullptr;
+  const OutboundQueue *m_outbound_queue = nullptr;
+  const LogForwarder *m_log_forwarder = nullptr;
+  PublisherTask *m_publisher = nullptr;
+  RuntimeStats *m_runtime_stats = nullptr;
+  LatencyTracer *m_latency_tracer = nullptr;
+  // start of the oldest unpublished change and of the last set command per
+  // property slot, 0 when there is none; only used while tracing
+  struct TraceTimes {
+    uint32_t notify_us;
+    uint32_t set_us;
+  };
+  std::vector<TraceTimes> m_trace_times;
+  TraceStamp take_trace_stamp(size_t slot);
+  // sorted by node id
+  std::vector<HomieNodeBase *> m_nodes;
+
+  std::vector<HomieNodeBase *>::const_iterator find_node(std::string_view id) const;
+
+  const HomieTopology *m_topology = nullptr;
+  bool apply_topology();
+
+  // all properties of attached nodes, indexed by HomiePropertyBase::get_slot()
+  std::vector<HomiePropertyBase *> m_properties;
+  std::vector<uint32_t> m_dirty_properties;
+  // dirty properties published even when their value did not change
+  std::vector<uint32_t> m_forced_properties;
+  bool m_any_dirty = false;
+
+  // notifications waiting for process(), NOTIFY_* flags per property slot
+  static constexpr uint8_t NOTIFY_CHANGED = 1;
+  static constexpr uint8_t NOTIFY_NODE = 2;
+  static constexpr uint8_t NOTIFY_FORCE = 4;
+  PendingSlots m_notifications;
+  // micros() of the oldest pending notification per slot, only while tracing
+  std::vector<std::atomic<uint32_t>> m_notify_times;
+
+  void receive_notifications(uint32_t now);
+  void mark_dirty(size_t slot, bool force, uint32_t time_us = 0);
+  void flush_dirty_properties();
+
+  // nodes with a publish policy, checked every loop for due publishes
+  std::vector<HomieNodeBase *> m_limited_nodes;
 
   homie::device_state m_device_state = homie::device_state::disconnected;
+  // connection changed, check_device_state() runs in the next loop
+  bool m_state_check_pending = false;
 
   int m_stat_update_interval = 60000;
+
+  bool m_skip_unchanged_metadata = false;
+  ESPPreferenceObject m_metadata_pref;
+  // digest of metadata known to be on the broker and of the one being published
+  uint32_t m_published_metadata_digest = 0;
+  uint32_t m_pending_metadata_digest = 0;
+  uint32_t m_metadata_dropped = 0;
   mutable uint64_t m_uptime_ms = 0;
 
   uint64_t get_uptime_seconds() const;
 
   void goto_state(homie::device_state new_state);
+  void start_device_info();
+  void store_metadata_digest();
+  // publishes $stats and starts the next stats interval
+  void publish_stats();
   void check_device_state();
 };
 
@@ -7,43 +7,85 @@
 namespace esphome {
 namespace mqtt_homie {
 
-std::string HomieNodeBase::get_id() const { return GetEntityBase()->get_object_id(); }
+std::string_view HomieNodeBase::get_id() const {
+  if (m_topology_id)
+    return m_topology_id;
+  if (m_id.empty())
+    m_id = GetEntityBase()->get_object_id();
+  return m_id;
+}
+
+void HomieNodeBase::set_topology_id(const char *id) {
+  m_topology_id = id;
+  std::string().swap(m_id);
+}
 
-std::string HomieNodeBase::get_name() const { return GetEntityBase()->get_name(); }
+std::string_view HomieNodeBase::get_name() const {
+  const auto &name = GetEntityBase()->get_name();
+  return {name.c_str(), name.size()};
+}
 
 std::string HomieNodeBase::get_name(int64_t node_idx) const { return ""; }
 
-std::string HomieNodeBase::get_type() const { return ""; }
+std::string_view HomieNodeBase::get_type() const { return ""; }
 
 bool HomieNodeBase::is_array() const { return false; }
 
 std::pair<int64_t, int64_t> HomieNodeBase::array_range() const { return {0, 0}; }
 
-std::map<std::string, std::string> HomieNodeBase::get_attributes() const {
+void HomieNodeBase::for_each_attribute(homie::attribute_visitor visitor) const {
   auto base = GetEntityBase();
   auto base_class = const_cast<EntityBase_DeviceClass *>(GetEntityBaseDeviceClass());
-  return {
-      {"icon", base->get_icon()},
-      {"class", base_class ? base_class->get_device_class() : std::string()},
-  };
+  visitor("icon", base->get_icon());
+  visitor("class", base_class ? base_class->get_device_class() : std::string());
 }
 
 void HomieNodeBase::notify_property_changed(HomiePropertyBase *property) {
-  if (device) {
-    this->defer("send", [this, property]() {  //
-      device->notify_node_changed(this, property);
-    });
+  if (device)
+    device->notify_node_changed(this, property);
+}
+
+bool HomieNodeBase::accept_change(HomiePropertyBase &property, uint32_t now) {
+  if (!m_limiter)
+    return true;
+  const size_t index = property.get_slot() - m_first_slot;
+  return index >= m_limiter->size() || m_limiter->on_change(index, property, now);
+}
+
+void HomieNodeBase::set_publish_policy(float deadband, bool deadband_relative,
+                                       uint32_t min_interval_ms, uint32_t heartbeat_ms) {
+  m_limiter = std::make_unique<PublishLimiter>(
+      PublishPolicy{deadband, deadband_relative, min_interval_ms, heartbeat_ms},
+      get_property_count());
+}
+
+uint32_t HomieNodeBase::check_publish_limits(uint32_t now) {
+  uint32_t due_ms = UINT32_MAX;
+  if (!device || !m_limiter)
+    return due_ms;
+  for (size_t i = 0; i < m_limiter->size(); ++i) {
+    auto property = static_cast<HomiePropertyBase *>(get_property_at(i));
+    if (m_limiter->is_due(i, *property, now))
+      device->notify_node_changed(this, property, true);
+    due_ms = std::min(due_ms, m_limiter->due_in(i, now));
   }
+  return due_ms;
 }
 
 void HomieNodeBase::notify_property_changed(const std::string &name) {
-  notify_property_changed(static_cast<HomiePropertyBase *>(get_property(name)));
+  if (auto property = get_property(name))
+    notify_property_changed(static_cast<HomiePropertyBase *>(property));
 }
 void HomieNodeBase::notify_all_properties_changed() { notify_property_changed(nullptr); }
 
 void HomieNodeMultiProperty::attach_property(std::unique_ptr<HomiePropertyBase> property) {
   property->set_parent(this);
-  m_properties_map[property->get_id()] = std::move(property);
+  auto it = find_property(property->get_id());
+  if (it != m_properties.end() && (*it)->get_id() == property->get_id()) {
+    ESP_LOGW(TAG, "Duplicate property id '%s'", std::string(property->get_id()).c_str());
+    return;
+  }
+  m_properties.insert(it, std::move(property));
 }
 
 void HomieNodeMultiProperty::create_properties(std::initializer_list<PropertyDescriptor> descriptors) {
@@ -52,24 +94,32 @@ void HomieNodeMultiProperty::create_properties(std::initializer_list<PropertyDes
   }
 }
 
-std::set<std::string> HomieNodeMultiProperty::get_properties() const {
-  std::set<std::string> r;
-  std::transform(m_properties_map.begin(), m_properties_map.end(), std::inserter(r, r.end()),
-                 [](const auto &item) { return item.first; });
-  return r;
+std::vector<std::unique_ptr<HomiePropertyBase>>::const_iterator
+HomieNodeMultiProperty::find_property(std::string_view id) const {
+  return std::lower_bound(
+      m_properties.begin(), m_properties.end(), id,
+      [](const auto &property, std::string_view id) { return property->get_id() < id; });
+}
+
+homie::const_property_ptr HomieNodeMultiProperty::get_property_at(size_t index) const {
+  return m_properties[index].get();
+}
+
+homie::property_ptr HomieNodeMultiProperty::get_property_at(size_t index) {
+  return m_properties[index].get();
 }
 
-homie::const_property_ptr HomieNodeMultiProperty::get_property(const std::string &id) const {
-  auto it = m_properties_map.find(id);
-  if (it != m_properties_map.end())
-    return it->second.get();
+homie::const_property_ptr HomieNodeMultiProperty::get_property(std::string_view id) const {
+  auto it = find_property(id);
+  if (it != m_properties.end() && (*it)->get_id() == id)
+    return it->get();
   return nullptr;
 }
 
-homie::property_ptr HomieNodeMultiProperty::get_property(const std::string &id) {
-  auto it = m_properties_map.find(id);
-  if (it != m_properties_map.end())
-    return it->second.get();
+homie::property_ptr HomieNodeMultiProperty::get_property(std::string_view id) {
+  auto it = find_property(id);
+  if (it != m_properties.end() && (*it)->get_id() == id)
+    return it->get();
   return nullptr;
 }
 
@@ -83,11 +133,11 @@ void HomiePropertyBase::notify_changed() {
 
 HomiePropertyFunctor::HomiePropertyFunctor(PropertyDescriptor descriptor) : m_descriptor(std::move(descriptor)) {}
 
-std::string HomiePropertyFunctor::get_id() const { return m_descriptor.id; }
-std::string HomiePropertyFunctor::get_name() const { return m_descriptor.name; }
+std::string_view HomiePropertyFunctor::get_id() const { return m_descriptor.id; }
+std::string_view HomiePropertyFunctor::get_name() const { return m_descriptor.name; }
 homie::datatype HomiePropertyFunctor::get_datatype() const { return m_descriptor.datatype; }
-std::string HomiePropertyFunctor::get_format() const { return m_descriptor.format; }
-std::string HomiePropertyFunctor::get_unit() const { return m_descriptor.unit; }
+std::string_view HomiePropertyFunctor::get_format() const { return m_descriptor.format; }
+std::string_view HomiePropertyFunctor::get_unit() const { return m_descriptor.unit; }
 bool HomiePropertyFunctor::is_settable() const { return static_cast<bool>(m_descriptor.setter); }
 bool HomiePropertyFunctor::is_retained() const { return m_descriptor.retained; }
 
@@ -105,7 +155,7 @@ void HomiePropertyFunctor::set_value(const std::string &value) {
   }
 }
 
-std::map<std::string, std::string> HomiePropertyFunctor::get_attributes() const { return {}; }
+void HomiePropertyFunctor::for_each_attribute(homie::attribute_visitor visitor) const {}
 
 }  // namespace mqtt_homie
 }  // namespace esphome
@@ -12,6 +12,7 @@
 
 #include <stdexcept>
 #include "homie-cpp.h"
+#include "publish_limiter.h"
 
 namespace esphome {
 namespace mqtt_homie {
@@ -20,26 +21,56 @@ class Proxy;
 class HomieDevice;
 class HomiePropertyBase;
 
-class HomieNodeBase : public Component, public homie::node {
+// Nodes are plain objects attached to HomieDevice, which does all their
+// deferred work (publishing, publish limits) in HomieDevice::process()
+class HomieNodeBase : public homie::node {
  public:
   static constexpr auto TAG = "homie:node";
 
-  std::string get_id() const override;
-  std::string get_name() const override;
+  std::string_view get_id() const override;
+  std::string_view get_name() const override;
   std::string get_name(int64_t node_idx) const override;
-  std::string get_type() const override;
+  std::string_view get_type() const override;
   bool is_array() const override;
   std::pair<int64_t, int64_t> array_range() const override;
 
-  std::map<std::string, std::string> get_attributes() const override;
-
-  void attach_device(HomieDevice *device) { this->device = device; }
+  void for_each_attribute(homie::attribute_visitor visitor) const override;
+  std::string_view get_property_list() const override { return m_property_list; }
+  void set_property_list(const char *properties) { m_property_list = properties; }
+  // Id from the generated topology, replaces the copy of the entity object id
+  void set_topology_id(const char *id);
+
+  void attach_device(HomieDevice *device, size_t first_slot, size_t slot_count) {
+    this->device = device;
+    m_first_slot = first_slot;
+    m_slot_count = slot_count;
+  }
+  // range of HomieDevice property slots owned by this node
+  std::pair<size_t, size_t> get_property_slots() const { return {m_first_slot, m_slot_count}; }
   void notify_property_changed(HomiePropertyBase *property);
   void notify_property_changed(const std::string &name);
   void notify_all_properties_changed();
 
+  // Limits publishing of property changes, see PublishPolicy
+  void set_publish_policy(float deadband, bool deadband_relative, uint32_t min_interval_ms,
+                          uint32_t heartbeat_ms);
+  bool has_publish_limits() const { return m_limiter != nullptr; }
+  // Device processing only: whether a change of property passes the publish policy
+  bool accept_change(HomiePropertyBase &property, uint32_t now);
+  // Publishes held back changes and heartbeats that are due, returns the
+  // milliseconds until the next one is due or UINT32_MAX
+  uint32_t check_publish_limits(uint32_t now);
+
  protected:
   HomieDevice *device = nullptr;
+  std::unique_ptr<PublishLimiter> m_limiter;
+  size_t m_first_slot = 0;
+  size_t m_slot_count = 0;
+  // EntityBase builds object id on every call, keep it for get_id() unless
+  // the generated topology provides it
+  mutable std::string m_id;
+  const char *m_topology_id = nullptr;
+  const char *m_property_list = "";
   virtual const esphome::EntityBase *GetEntityBase() const = 0;
   virtual const esphome::EntityBase_DeviceClass *GetEntityBaseDeviceClass() const { return nullptr; }
 };
@@ -57,16 +88,22 @@ struct PropertyDescriptor {
 
 class HomieNodeMultiProperty : public HomieNodeBase {
  public:
-  std::set<std::string> get_properties() const final;
-  homie::const_property_ptr get_property(const std::string &id) const final;
-  homie::property_ptr get_property(const std::string &id) final;
+  size_t get_property_count() const final { return m_properties.size(); }
+  homie::const_property_ptr get_property_at(size_t index) const final;
+  homie::property_ptr get_property_at(size_t index) final;
+  homie::const_property_ptr get_property(std::string_view id) const final;
+  homie::property_ptr get_property(std::string_view id) final;
 
  protected:
   void attach_property(std::unique_ptr<HomiePropertyBase> property);
   void create_properties(std::initializer_list<PropertyDescriptor> descriptors);
 
  private:
-  std::map<std::string, std::unique_ptr<HomiePropertyBase>> m_properties_map;
+  // sorted by property id
+  std::vector<std::unique_ptr<HomiePropertyBase>> m_properties;
+
+  std::vector<std::unique_ptr<HomiePropertyBase>>::const_iterator find_property(
+      std::string_view id) const;
 };
 
 class HomiePropertyBase : public homie::property {
@@ -74,14 +111,19 @@ class HomiePropertyBase : public homie::property {
   static constexpr auto TAG = "homie:property";
 
   void set_parent(HomieNodeBase *parent) { m_parent = parent; }
+  HomieNodeBase *get_parent() const { return m_parent; }
+  void set_slot(size_t slot) { m_slot = slot; }
+  size_t get_slot() const { return m_slot; }
+  void set_topic_suffix(const char *suffix) { m_topic_suffix = suffix; }
+  std::string_view get_topic_suffix() const override { return m_topic_suffix; }
 
-  std::string get_id() const override = 0;
-  std::string get_name() const override = 0;
+  std::string_view get_id() const override = 0;
+  std::string_view get_name() const override = 0;
 
   homie::datatype get_datatype() const override { return homie::datatype::string; };
-  std::string get_format() const override { return ""; }
+  std::string_view get_format() const override { return ""; }
   std::string get_value() const override { return ""; }
-  std::string get_unit() const override { return ""; }
+  std::string_view get_unit() const override { return ""; }
 
   std::string get_value(int64_t node_idx) const override { return ""; }
   void set_value(int64_t node_idx, const std::string &value) override{};
@@ -90,25 +132,27 @@ class HomiePropertyBase : public homie::property {
   bool is_settable() const override { return false; }
   bool is_retained() const override { return false; }
 
-  std::map<std::string, std::string> get_attributes() const override { return {}; }
+  void for_each_attribute(homie::attribute_visitor visitor) const override {}
 
   void notify_changed();
 
  protected:
   HomieNodeBase *m_parent;
+  size_t m_slot = SIZE_MAX;
+  const char *m_topic_suffix = "";
 };
 
 class HomiePropertyFunctor : public HomiePropertyBase {
  public:
   HomiePropertyFunctor(PropertyDescriptor descriptor);
 
-  std::string get_id() const override;
-  std::string get_name() const override;
+  std::string_view get_id() const override;
+  std::string_view get_name() const override;
 
   homie::datatype get_datatype() const override;
-  std::string get_format() const override;
+  std::string_view get_format() const override;
   std::string get_value() const override;
-  std::string get_unit() const override;
+  std::string_view get_unit() const override;
 
   std::string get_value(int64_t node_idx) const override;
   void set_value(int64_t node_idx, const std::string &value) override;
@@ -117,7 +161,7 @@ class HomiePropertyFunctor : public HomiePropertyBase {
   bool is_settable() const override;
   bool is_retained() const override;
 
-  std::map<std::string, std::string> get_attributes() const override;
+  void for_each_attribute(homie::attribute_visitor visitor) const override;
 
  private:
   const PropertyDescriptor m_descriptor;
@@ -31,13 +31,15 @@ template<class PropertyClass> class HomieNodeSingleProperty : public HomieNodeBa
     property.set_parent(this);
   }
 
-  std::set<std::string> get_properties() const override { return {property.get_id()}; }
-  homie::const_property_ptr get_property(const std::string &id) const override {
+  size_t get_property_count() const override { return 1; }
+  homie::const_property_ptr get_property_at(size_t index) const override { return &property; }
+  homie::property_ptr get_property_at(size_t index) override { return &property; }
+  homie::const_property_ptr get_property(std::string_view id) const override {
     if (id == property.get_id())
       return &property;
     return nullptr;
   }
-  homie::property_ptr get_property(const std::string &id) override {
+  homie::property_ptr get_property(std::string_view id) override {
     if (id == property.get_id())
       return &property;
     return nullptr;
@@ -60,23 +62,37 @@ class HomieSensorProperty : public HomiePropertyBase {
 
   HomieSensorProperty(TargetType *target) : target(target) {}
 
-  std::string get_id() const override { return "value"; }
-  std::string get_name() const override { return "Value"; }
+  std::string_view get_id() const override { return "value"; }
+  std::string_view get_name() const override { return "Value"; }
   homie::datatype get_datatype() const override { return homie::datatype::number; }
 
-  std::string get_unit() const { return target->get_unit_of_measurement(); }
+  std::string_view get_unit() const override {
+    if (m_unit.empty())
+      m_unit = target->get_unit_of_measurement();
+    return m_unit;
+  }
 
   std::string get_value() const override {
-    int8_t accuracy = target->get_accuracy_decimals();
-    return value_accuracy_to_string(target->get_state(), accuracy);
+    char buffer[homie::value_buffer_size];
+    return std::string(buffer, format_value(buffer, sizeof(buffer)));
+  }
+  size_t format_value(char *buffer, size_t size) const override {
+    return homie::format_fixed(buffer, size, target->get_state(), target->get_accuracy_decimals());
   }
 
-  std::map<std::string, std::string> get_attributes() const override {
-    return {
-        {"accuracy", std::to_string(target->get_accuracy_decimals())},
-        {"state_class", state_class_to_string(target->get_state_class())},
-    };
+  bool get_typed_value(homie::typed_value &value) const override {
+    value = homie::typed_value::make_number(target->get_state());
+    return true;
   }
+
+  void for_each_attribute(homie::attribute_visitor visitor) const override {
+    visitor("accuracy", std::to_string(target->get_accuracy_decimals()));
+    visitor("state_class", state_class_to_string(target->get_state_class()));
+  }
+
+ private:
+  // unit of measurement does not change at runtime
+  mutable std::string m_unit;
 };
 using HomieNodeSensor = HomieNodeSingleProperty<HomieSensorProperty>;
 #endif
@@ -90,18 +106,29 @@ class HomieSwitchProperty : public HomiePropertyBase {
 
   HomieSwitchProperty(TargetType *target) : target(target) {}
 
-  std::string get_id() const override { return "state"; }
-  std::string get_name() const override { return "State"; }
+  std::string_view get_id() const override { return "state"; }
+  std::string_view get_name() const override { return "State"; }
   bool is_settable() const override { return true; }
   homie::datatype get_datatype() const override { return homie::datatype::boolean; }
 
-  std::map<std::string, std::string> get_attributes() const override {
-    return {
-        {"inverted", target->is_inverted() ? "true" : "false"},
-    };
+  void for_each_attribute(homie::attribute_visitor visitor) const override {
+    visitor("inverted", target->is_inverted() ? "true" : "false");
   }
 
   std::string get_value() const override { return target->state ? "true" : "false"; }
+
+  bool get_typed_value(homie::typed_value &value) const override {
+    value = homie::typed_value::make_boolean(target->state);
+    return true;
+  }
+  bool set_typed_value(const homie::typed_value &value) override {
+    if (value.boolean)
+      target->turn_on();
+    else
+      target->turn_off();
+    return true;
+  }
+
   void set_value(const std::string &value) override {
     switch (parse_on_off(value.c_str())) {
       case PARSE_ON:
@@ -131,8 +158,8 @@ class HomieBinarySensorProperty : public HomiePropertyBase {
 
   HomieBinarySensorProperty(TargetType *target) : target(target) {}
 
-  std::string get_id() const override { return "state"; }
-  std::string get_name() const override { return "State"; }
+  std::string_view get_id() const override { return "state"; }
+  std::string_view get_name() const override { return "State"; }
   homie::datatype get_datatype() const override { return homie::datatype::boolean; }
 
   std::string get_value() const override { return target->state ? "true" : "false"; }
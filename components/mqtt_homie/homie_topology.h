@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::mqtt_homie {
+
+// Device topology generated by the Python controller, see HomieController.
+// Nodes are sorted by id, properties of each node are sorted by id and stored
+// contiguously starting at first_property.
+//
+// The table lives in flash and replaces strings the device would otherwise
+// build and keep in RAM: node ids (copies of the entity object ids), the $nodes
+// and $properties payloads. Nodes and properties stay regular objects, they
+// carry the values and set handlers. homie::client still concatenates each
+// topic suffix with the device topic once, when it builds its value topic table.
+
+struct HomieTopologyProperty {
+  const char *id;
+  // "<node>/<property>", value topic relative to the device topic
+  const char *topic_suffix;
+};
+
+struct HomieTopologyNode {
+  const char *id;
+  // $properties payload
+  const char *properties;
+  uint16_t first_property;
+  uint16_t property_count;
+};
+
+struct HomieTopology {
+  const HomieTopologyNode *nodes;
+  size_t node_count;
+  const HomieTopologyProperty *properties;
+  size_t property_count;
+  // $nodes payload
+  const char *node_list;
+};
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,55 @@
+#include "latency_tracer.h"
+
+#include <algorithm>
+
+#include "homie-cpp.h"
+
+namespace esphome::mqtt_homie {
+
+constexpr std::array<uint32_t, 12> LatencyHistogram::BUCKET_LIMITS_US;
+
+void LatencyHistogram::add(uint32_t us) {
+  const auto bucket = std::lower_bound(BUCKET_LIMITS_US.begin(), BUCKET_LIMITS_US.end(), us);
+  ++m_counts[bucket - BUCKET_LIMITS_US.begin()];
+  m_max_us = std::max(m_max_us, us);
+}
+
+// Comma separated values, returns the length or 0 when buffer is too small
+static size_t format_list(const uint32_t *values, size_t count, char *buffer, size_t size) {
+  size_t length = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i != 0) {
+      if (length + 1 >= size)
+        return 0;
+      buffer[length++] = ',';
+    }
+    const size_t digits = homie::format_unsigned(buffer + length, size - length, values[i]);
+    if (digits == 0)
+      return 0;
+    length += digits;
+  }
+  return length;
+}
+
+size_t LatencyHistogram::format(char *buffer, size_t size) const {
+  return format_list(m_counts.data(), m_counts.size(), buffer, size);
+}
+
+size_t LatencyHistogram::format_limits(char *buffer, size_t size) {
+  return format_list(BUCKET_LIMITS_US.data(), BUCKET_LIMITS_US.size(), buffer, size);
+}
+
+void LatencyTracer::on_sent(const TraceStamp &stamp, uint32_t now_us) {
+  switch (stamp.origin) {
+    case TraceStamp::NOTIFY:
+      m_notify.add(now_us - stamp.since_us);
+      break;
+    case TraceStamp::SET:
+      m_set.add(now_us - stamp.since_us);
+      break;
+    case TraceStamp::NONE:
+      break;
+  }
+}
+
+}  // namespace esphome::mqtt_homie
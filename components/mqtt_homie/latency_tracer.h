@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::mqtt_homie {
+
+// Start of a traced property publish, carried along with the queued message
+struct TraceStamp {
+  enum Origin : uint8_t {
+    NONE,
+    // property change notification
+    NOTIFY,
+    // set command, the publish is its echo
+    SET,
+  };
+
+  uint32_t since_us = 0;
+  Origin origin = NONE;
+};
+
+// Latency histogram with fixed buckets
+class LatencyHistogram {
+ public:
+  // upper bounds of all but the last bucket, which takes everything above
+  static constexpr std::array<uint32_t, 12> BUCKET_LIMITS_US = {
+      1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000};
+  static constexpr size_t BUCKET_COUNT = BUCKET_LIMITS_US.size() + 1;
+
+  void add(uint32_t us);
+  uint32_t max_us() const { return m_max_us; }
+  // bucket counts as "n0,n1,...", returns the length or 0 when buffer is too small
+  size_t format(char *buffer, size_t size) const;
+  // BUCKET_LIMITS_US in the same format
+  static size_t format_limits(char *buffer, size_t size);
+  void reset() { *this = LatencyHistogram{}; }
+
+ private:
+  std::array<uint32_t, BUCKET_COUNT> m_counts{};
+  uint32_t m_max_us = 0;
+};
+
+// Measures notify -> MQTT client and set command -> echo publish latencies.
+// HomieDevice opens a trace around each property publish, MqttProxy closes
+// it when the message is handed to the MQTT client, directly or after it
+// waited in the outbound queue. Main loop (or publisher task) only.
+class LatencyTracer {
+ public:
+  // length of a formatted histogram
+  static constexpr size_t FORMAT_SIZE = LatencyHistogram::BUCKET_COUNT * 11;
+  // publishes later than this after a set command are not counted as its echo
+  static constexpr uint32_t SET_ECHO_TIMEOUT_US = LatencyHistogram::BUCKET_LIMITS_US.back();
+
+  void begin(TraceStamp stamp) { m_current = stamp; }
+  void end() { m_current = {}; }
+  // stamp of the publish in progress
+  const TraceStamp &current() const { return m_current; }
+  void on_sent(const TraceStamp &stamp, uint32_t now_us);
+
+  const LatencyHistogram &notify() const { return m_notify; }
+  const LatencyHistogram &set() const { return m_set; }
+  void reset() {
+    m_notify.reset();
+    m_set.reset();
+  }
+
+ private:
+  TraceStamp m_current;
+  LatencyHistogram m_notify;
+  LatencyHistogram m_set;
+};
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,166 @@
+#include "log_forwarder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "homie-cpp.h"
+
+namespace esphome::mqtt_homie {
+
+// ESPHome log level -> letter, like the logger's own prefix
+static constexpr char LEVEL_LETTERS[] = "-EWICDVV";
+
+// Moves p to the last character of an ANSI color sequence starting at p
+static bool skip_color(const char *&p) {
+  if (*p != '\033')
+    return false;
+  while (p[1] != '\0' && p[1] != 'm')
+    ++p;
+  if (p[1] == 'm')
+    ++p;
+  return true;
+}
+
+// Length of message without ANSI color sequences
+static size_t visible_length(const char *message) {
+  size_t length = 0;
+  for (const char *p = message; *p != '\0'; ++p) {
+    if (!skip_color(p))
+      ++length;
+  }
+  return length;
+}
+
+void LogForwarder::configure(size_t buffer_size, uint32_t flush_interval_ms, uint32_t rate_per_s,
+                             uint32_t burst) {
+  m_ingress.reserve(buffer_size);
+  m_capacity = buffer_size;
+  m_flush_interval_ms = flush_interval_ms;
+  m_rate_per_s = rate_per_s;
+  m_burst_milli = burst * 1000;
+  m_tokens_milli = m_burst_milli;
+  // room for the suppressed line note
+  m_batch.reserve(buffer_size + 48);
+}
+
+void LogForwarder::set_tag_level(std::string tag, int level) {
+  auto it = std::lower_bound(
+      m_tag_levels.begin(), m_tag_levels.end(), tag,
+      [](const auto &entry, const std::string &tag) { return entry.first < tag; });
+  if (it != m_tag_levels.end() && it->first == tag) {
+    it->second = level;
+    return;
+  }
+  m_tag_levels.insert(it, {std::move(tag), level});
+}
+
+int LogForwarder::level_for(const char *tag) const {
+  if (m_tag_levels.empty() || tag == nullptr)
+    return m_level;
+  const std::string_view key(tag);
+  auto it = std::lower_bound(
+      m_tag_levels.begin(), m_tag_levels.end(), key,
+      [](const auto &entry, std::string_view key) { return entry.first < key; });
+  if (it != m_tag_levels.end() && it->first == key)
+    return it->second;
+  return m_level;
+}
+
+bool LogForwarder::take_token(uint32_t now) {
+  if (m_rate_per_s == 0)
+    return true;
+  const uint32_t elapsed = now - m_last_refill_ms;
+  m_last_refill_ms = now;
+  // rate per second is rate per ms in thousandths
+  const uint64_t tokens = m_tokens_milli + static_cast<uint64_t>(elapsed) * m_rate_per_s;
+  m_tokens_milli = static_cast<uint32_t>(std::min<uint64_t>(tokens, m_burst_milli));
+  if (m_tokens_milli < 1000)
+    return false;
+  m_tokens_milli -= 1000;
+  return true;
+}
+
+bool LogForwarder::push(int level, const char *tag, const char *message) {
+  if (m_publishing.load(std::memory_order_relaxed)) {
+    m_reentrant.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  // m_tag_levels is not modified any more, reading it from any task is safe
+  if (level > level_for(tag) || m_capacity == 0)
+    return false;
+
+  // the logger usually formats lines as "[W][tag:line]: text" already
+  const char *first = message;
+  while (skip_color(first))
+    ++first;
+  char prefix[32] = "";
+  if (*first != '[') {
+    const char letter = LEVEL_LETTERS[std::clamp(level, 0, 7)];
+    std::snprintf(prefix, sizeof(prefix), "[%c][%s]: ", letter, tag ? tag : "");
+  }
+  const size_t prefix_length = std::strlen(prefix);
+  // a single line may take at most a quarter of the buffer
+  const size_t limit = std::max(m_capacity / 4, TRUNCATED.size());
+  const size_t visible = visible_length(message);
+  const size_t length = std::min(visible, limit);
+  const size_t kept = visible > limit ? limit - TRUNCATED.size() : length;
+
+  return m_ingress.try_push(prefix_length + length, [&](char *line) {
+    std::memcpy(line, prefix, prefix_length);
+    line += prefix_length;
+    size_t written = 0;
+    for (const char *p = message; *p != '\0' && written < kept; ++p) {
+      if (!skip_color(p))
+        line[written++] = *p;
+    }
+    if (kept != length)
+      TRUNCATED.copy(line + written, TRUNCATED.size());
+  });
+}
+
+uint32_t LogForwarder::flush_due_in(uint32_t now) const {
+  if (m_batch.empty() && m_suppressed.total() == m_reported_suppressed)
+    return UINT32_MAX;
+  const uint32_t elapsed = now - m_last_flush_ms;
+  return elapsed >= m_flush_interval_ms ? 0 : m_flush_interval_ms - elapsed;
+}
+
+void LogForwarder::receive(uint32_t now) {
+  while (m_ingress.try_pop(
+      [&](const char *line, size_t length) { add(std::string_view(line, length), now); })) {
+  }
+  const uint32_t dropped = m_ingress.dropped();
+  m_suppressed.overflow += dropped - m_ingress_dropped;
+  m_ingress_dropped = dropped;
+  m_suppressed.reentrant += m_reentrant.exchange(0, std::memory_order_relaxed);
+}
+
+void LogForwarder::add(std::string_view line, uint32_t now) {
+  if (!take_token(now)) {
+    ++m_suppressed.rate;
+    return;
+  }
+  if (m_batch.size() + line.size() + 1 > m_capacity) {
+    ++m_suppressed.overflow;
+    return;
+  }
+  m_batch += line;
+  m_batch += '\n';
+}
+
+void LogForwarder::finish_batch() {
+  const uint32_t suppressed = m_suppressed.total();
+  if (suppressed != m_reported_suppressed) {
+    char count[homie::value_buffer_size];
+    m_batch += "[homie] ";
+    m_batch.append(count, homie::format_unsigned(count, sizeof(count),
+                                                 suppressed - m_reported_suppressed));
+    m_batch += " log lines suppressed\n";
+    m_reported_suppressed = suppressed;
+  }
+  if (!m_batch.empty() && m_batch.back() == '\n')
+    m_batch.pop_back();
+}
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mpsc_ring.h"
+
+namespace esphome::mqtt_homie {
+
+// Collects log lines for $log. Lines may be logged from any task: they pass
+// per-tag level filters and are formatted into a lock-free ingress ring of
+// buffer_size bytes. The main loop moves them through a token bucket into the
+// next batch (at most buffer_size bytes) and publishes batches of several
+// lines per message. Lines logged while a batch is being published are
+// dropped by a re-entrancy guard.
+class LogForwarder {
+ public:
+  struct Counters {
+    // dropped by the rate limit, because a ring was full, or re-entrantly logged
+    uint32_t rate = 0;
+    uint32_t overflow = 0;
+    uint32_t reentrant = 0;
+
+    uint32_t total() const { return rate + overflow + reentrant; }
+  };
+
+  // appended to lines cut at a quarter of the buffer size
+  static constexpr std::string_view TRUNCATED = "...";
+
+  // Reserves the buffers, call before the first push()
+  void configure(size_t buffer_size, uint32_t flush_interval_ms, uint32_t rate_per_s,
+                 uint32_t burst);
+  void set_level(int level) { m_level = level; }
+  // Overrides the level for one tag, levels must not change once push() is called
+  void set_tag_level(std::string tag, int level);
+
+  // Logger callback, safe from any task. Never blocks or allocates. Returns
+  // true when the line was queued for the next flush().
+  bool push(int level, const char *tag, const char *message);
+  // Single consumer (main loop or publisher task): takes lines pushed since
+  // the last call and calls publish with the batch once the flush interval passed
+  template<typename F> void flush(uint32_t now, F &&publish);
+  // Milliseconds until flush() publishes what it took so far, UINT32_MAX when
+  // there is nothing to publish
+  uint32_t flush_due_in(uint32_t now) const;
+
+  const Counters &suppressed() const { return m_suppressed; }
+
+ private:
+  int level_for(const char *tag) const;
+  // moves lines from m_ingress into m_batch
+  void receive(uint32_t now);
+  void add(std::string_view line, uint32_t now);
+  bool take_token(uint32_t now);
+  // completes m_batch before it is published
+  void finish_batch();
+
+  int m_level = 0;
+  // sorted by tag
+  std::vector<std::pair<std::string, int>> m_tag_levels;
+
+  // size of a batch, lines are cut at a quarter of it
+  size_t m_capacity = 0;
+
+  uint32_t m_flush_interval_ms = 1000;
+  uint32_t m_last_flush_ms = 0;
+  // token bucket in thousandths of a line
+  uint32_t m_rate_per_s = 0;
+  uint32_t m_burst_milli = 0;
+  uint32_t m_tokens_milli = 0;
+  uint32_t m_last_refill_ms = 0;
+
+  MpscByteRing m_ingress;
+  // set while a batch is published, lines pushed meanwhile count as reentrant
+  std::atomic<bool> m_publishing{false};
+  std::atomic<uint32_t> m_reentrant{0};
+  uint32_t m_ingress_dropped = 0;
+
+  Counters m_suppressed;
+  uint32_t m_reported_suppressed = 0;
+  // lines received since the last flush, the payload of the next batch
+  std::string m_batch;
+};
+
+template<typename F> void LogForwarder::flush(uint32_t now, F &&publish) {
+  receive(now);
+  if (now - m_last_flush_ms < m_flush_interval_ms)
+    return;
+  m_last_flush_ms = now;
+  if (m_batch.empty() && m_suppressed.total() == m_reported_suppressed)
+    return;
+
+  finish_batch();
+  m_publishing.store(true, std::memory_order_relaxed);
+  publish(std::string_view(m_batch));
+  m_publishing.store(false, std::memory_order_relaxed);
+  m_batch.clear();
+}
+
+}  // namespace esphome::mqtt_homie
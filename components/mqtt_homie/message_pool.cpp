@@ -0,0 +1,87 @@
+#include "message_pool.h"
+
+#include <cstring>
+
+namespace esphome::mqtt_homie {
+
+static char *next_free(const char *block) {
+  char *next;
+  std::memcpy(&next, block, sizeof(next));
+  return next;
+}
+
+static void set_next_free(char *block, char *next) { std::memcpy(block, &next, sizeof(next)); }
+
+void MessagePool::reserve(size_t size, const std::array<size_t, CLASS_COUNT> &weights) {
+  m_classes = {};
+  m_capacity = 0;
+  m_used = 0;
+  m_peak = 0;
+
+  size_t weight_sum = 0;
+  for (auto weight : weights)
+    weight_sum += weight;
+  std::array<size_t, CLASS_COUNT> counts;
+  size_t total = 0;
+  for (size_t i = 0; i < CLASS_COUNT; ++i) {
+    const size_t share = weight_sum != 0
+                             ? static_cast<size_t>(uint64_t(size) * weights[i] / weight_sum)
+                             : size / CLASS_COUNT;
+    counts[i] = share / BLOCK_SIZES[i];
+    total += counts[i] * BLOCK_SIZES[i];
+  }
+  m_arena.reset(total != 0 ? new char[total] : nullptr);
+  m_capacity = total;
+
+  char *position = m_arena.get();
+  for (size_t i = 0; i < CLASS_COUNT; ++i) {
+    auto &size_class = m_classes[i];
+    const size_t count = counts[i];
+    size_class.begin = position;
+    position += count * BLOCK_SIZES[i];
+    size_class.end = position;
+    // link back to front so blocks are handed out in address order
+    for (size_t j = count; j-- > 0;) {
+      char *block = size_class.begin + j * BLOCK_SIZES[i];
+      set_next_free(block, size_class.free_list);
+      size_class.free_list = block;
+    }
+  }
+}
+
+char *MessagePool::allocate(size_t size) {
+  for (size_t i = 0; i < CLASS_COUNT; ++i) {
+    auto &size_class = m_classes[i];
+    // a full class borrows from the next larger one
+    if (BLOCK_SIZES[i] < size || size_class.free_list == nullptr)
+      continue;
+    char *block = size_class.free_list;
+    size_class.free_list = next_free(block);
+    m_used += BLOCK_SIZES[i];
+    if (m_used > m_peak)
+      m_peak = m_used;
+    return block;
+  }
+  ++m_fallbacks;
+  return new char[size];
+}
+
+void MessagePool::release(char *block) {
+  if (block == nullptr)
+    return;
+  if (!owns(block)) {
+    delete[] block;
+    return;
+  }
+  for (size_t i = 0; i < CLASS_COUNT; ++i) {
+    auto &size_class = m_classes[i];
+    if (block < size_class.begin || block >= size_class.end)
+      continue;
+    set_next_free(block, size_class.free_list);
+    size_class.free_list = block;
+    m_used -= BLOCK_SIZES[i];
+    return;
+  }
+}
+
+}  // namespace esphome::mqtt_homie
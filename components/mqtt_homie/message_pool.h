@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome::mqtt_homie {
+
+// Fixed capacity slab allocator for outbound message storage. Blocks of a few
+// size classes are carved out of a single allocation made by reserve(), so
+// queueing messages does not fragment the general heap. Requests that do not
+// fit into any free block fall back to the heap and are counted.
+class MessagePool {
+ public:
+  static constexpr size_t CLASS_COUNT = 5;
+  static constexpr std::array<uint16_t, CLASS_COUNT> BLOCK_SIZES = {32, 64, 128, 256, 512};
+
+  // Splits size bytes over the size classes in proportion to weights (evenly
+  // when all are 0), 0 disables the pool. Must be called while nothing is
+  // allocated.
+  void reserve(size_t size, const std::array<size_t, CLASS_COUNT> &weights = {});
+
+  // Returns storage for at least size bytes
+  char *allocate(size_t size);
+  void release(char *block);
+
+  // bytes of the arena
+  size_t capacity() const { return m_capacity; }
+  // bytes of blocks in use and the highest value seen
+  size_t used() const { return m_used; }
+  size_t peak() const { return m_peak; }
+  // allocations served by the heap because no block was free or large enough
+  uint32_t fallbacks() const { return m_fallbacks; }
+
+ private:
+  struct SizeClass {
+    char *begin = nullptr;
+    char *end = nullptr;
+    // free blocks are linked through their first bytes
+    char *free_list = nullptr;
+  };
+
+  bool owns(const char *block) const {
+    return m_arena && block >= m_arena.get() && block < m_arena.get() + m_capacity;
+  }
+
+  std::unique_ptr<char[]> m_arena;
+  std::array<SizeClass, CLASS_COUNT> m_classes;
+  size_t m_capacity = 0;
+  size_t m_used = 0;
+  size_t m_peak = 0;
+  uint32_t m_fallbacks = 0;
+};
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace esphome::mqtt_homie {
+
+// Bounded lock-free multi-producer/single-consumer ring of variable length
+// records. Producers may run on any task, they never block or allocate and
+// fail when the ring is full. They reserve space by advancing the head and
+// commit the record through its header, a record that would wrap around is
+// preceded by a padding record. The consumer clears consumed space, so a
+// header reads 0 until committed. Only one task may consume.
+class MpscByteRing {
+ public:
+  MpscByteRing() = default;
+  MpscByteRing(const MpscByteRing &) = delete;
+  MpscByteRing &operator=(const MpscByteRing &) = delete;
+
+  // Allocates at least size bytes (rounded up to a power of two), 0 disables
+  // the ring. Call before the first push.
+  void reserve(size_t size) {
+    size_t capacity = 0;
+    if (size != 0) {
+      capacity = 4 * HEADER_SIZE;
+      while (capacity < size)
+        capacity *= 2;
+    }
+    m_buffer.reset(capacity != 0 ? new uint32_t[capacity / HEADER_SIZE]() : nullptr);
+    m_capacity = static_cast<uint32_t>(capacity);
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail.store(0, std::memory_order_relaxed);
+  }
+  size_t capacity() const { return m_capacity; }
+  // longest record push() accepts
+  size_t max_record() const { return m_capacity / 2 - HEADER_SIZE; }
+
+  // Reserves length bytes and calls fill(char *) to write them. Returns false
+  // when the ring is full or length exceeds max_record().
+  template<typename F> bool try_push(size_t length, F &&fill) {
+    if (m_capacity == 0 || length > max_record()) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    const uint32_t size = HEADER_SIZE + align(length);
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t offset, padding;
+    while (true) {
+      offset = head & (m_capacity - 1);
+      // records do not wrap, the rest of the buffer becomes padding instead
+      padding = m_capacity - offset < size ? m_capacity - offset : 0;
+      const uint32_t tail = m_tail.load(std::memory_order_acquire);
+      if (head + padding + size - tail > m_capacity) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (m_head.compare_exchange_weak(head, head + padding + size, std::memory_order_relaxed))
+        break;
+    }
+    if (padding != 0) {
+      commit(offset, PADDING | padding);
+      offset = 0;
+    }
+    fill(data() + offset + HEADER_SIZE);
+    commit(offset, static_cast<uint32_t>(length));
+    return true;
+  }
+
+  // Consumer side: calls consume(const char *, size_t) with the oldest record,
+  // returns false when there is none (or its producer is still writing it)
+  template<typename F> bool try_pop(F &&consume) {
+    while (true) {
+      const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+      const uint32_t offset = tail & (m_capacity - 1);
+      const uint32_t header = m_capacity != 0 ? load_header(offset) : 0;
+      if ((header & COMMITTED) == 0)
+        return false;
+      const uint32_t length = header & LENGTH_MASK;
+      const uint32_t size = (header & PADDING) != 0 ? length : HEADER_SIZE + align(length);
+      if ((header & PADDING) == 0)
+        consume(static_cast<const char *>(data() + offset + HEADER_SIZE), size_t(length));
+      // headers of later records may land anywhere in this space
+      std::memset(data() + offset, 0, size);
+      m_tail.store(tail + size, std::memory_order_release);
+      if ((header & PADDING) == 0)
+        return true;
+    }
+  }
+
+  // pushes that failed because the ring was full or the record too long
+  uint32_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr uint32_t HEADER_SIZE = sizeof(uint32_t);
+  static constexpr uint32_t COMMITTED = 1u << 31;
+  static constexpr uint32_t PADDING = 1u << 30;
+  static constexpr uint32_t LENGTH_MASK = PADDING - 1;
+
+  static uint32_t align(size_t length) {
+    return static_cast<uint32_t>((length + HEADER_SIZE - 1) & ~size_t(HEADER_SIZE - 1));
+  }
+  char *data() { return reinterpret_cast<char *>(m_buffer.get()); }
+  // headers are words of m_buffer, accessed atomically with the GCC builtins
+  // (payload bytes around them are plain memory)
+  void commit(uint32_t offset, uint32_t value) {
+    __atomic_store_n(&m_buffer[offset / HEADER_SIZE], COMMITTED | value, __ATOMIC_RELEASE);
+  }
+  uint32_t load_header(uint32_t offset) const {
+    return __atomic_load_n(&m_buffer[offset / HEADER_SIZE], __ATOMIC_ACQUIRE);
+  }
+
+  std::unique_ptr<uint32_t[]> m_buffer;
+  uint32_t m_capacity = 0;
+  // byte positions, increasing and wrapping at 2^32
+  std::atomic<uint32_t> m_head{0};
+  std::atomic<uint32_t> m_tail{0};
+  std::atomic<uint32_t> m_dropped{0};
+};
+
+}  // namespace esphome::mqtt_homie
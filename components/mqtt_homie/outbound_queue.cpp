@@ -0,0 +1,250 @@
+#include "outbound_queue.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace esphome::mqtt_homie {
+
+OutboundLane::~OutboundLane() {
+  while (!empty())
+    pop_front();
+}
+
+OutboundLane::Entry *OutboundLane::find(std::string_view topic, uint32_t hash) {
+  if (m_index.empty())
+    return nullptr;
+  const size_t mask = m_index.size() - 1;
+  for (size_t slot = hash & mask; m_index[slot] != 0; slot = (slot + 1) & mask) {
+    auto &entry = m_ring[m_index[slot] - 1];
+    if (entry.hash == hash && entry.topic_size == topic.size() &&
+        std::memcmp(entry.data, topic.data(), topic.size()) == 0)
+      return &entry;
+  }
+  return nullptr;
+}
+
+void OutboundLane::index_insert(size_t position, uint32_t hash) {
+  const size_t mask = m_index.size() - 1;
+  size_t slot = hash & mask;
+  while (m_index[slot] != 0)
+    slot = (slot + 1) & mask;
+  m_index[slot] = static_cast<uint32_t>(position + 1);
+}
+
+void OutboundLane::index_erase(size_t position, uint32_t hash) {
+  const size_t mask = m_index.size() - 1;
+  size_t slot = hash & mask;
+  while (m_index[slot] != position + 1)
+    slot = (slot + 1) & mask;
+  // move later entries of the probe sequence back into the hole
+  for (size_t next = (slot + 1) & mask; m_index[next] != 0; next = (next + 1) & mask) {
+    const size_t home = m_ring[m_index[next] - 1].hash & mask;
+    // entries whose home lies cyclically in (slot, next] stay reachable
+    const bool stays =
+        slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+    if (stays)
+      continue;
+    m_index[slot] = m_index[next];
+    slot = next;
+  }
+  m_index[slot] = 0;
+}
+
+char *OutboundLane::store(std::string_view topic, std::string_view payload) {
+  const size_t size = topic.size() + payload.size();
+  char *data = m_pool->allocate(size);
+  std::memcpy(data, topic.data(), topic.size());
+  std::memcpy(data + topic.size(), payload.data(), payload.size());
+  return data;
+}
+
+void OutboundLane::grow() {
+  std::vector<Entry> ring;
+  ring.resize(m_ring.empty() ? 8 : m_ring.size() * 2);
+  for (size_t i = 0; i < m_count; ++i)
+    ring[i] = at(i);
+  m_ring = std::move(ring);
+  m_head = 0;
+  if (m_policy != OverflowPolicy::REPLACE)
+    return;
+  m_index.assign(m_ring.size() * 2, 0);
+  for (size_t i = 0; i < m_count; ++i)
+    index_insert(i, m_ring[i].hash);
+}
+
+void OutboundLane::push(std::string_view topic, std::string_view payload, uint8_t qos,
+                        bool retain, TraceStamp trace) {
+  const size_t size = topic.size() + payload.size();
+  // would evict the whole lane and still not fit
+  if (size > m_max_bytes) {
+    ++m_dropped;
+    return;
+  }
+
+  const uint32_t hash = m_policy == OverflowPolicy::REPLACE ? homie::utils::fnv1a(topic) : 0;
+  if (m_policy == OverflowPolicy::REPLACE) {
+    if (auto *queued = find(topic, hash)) {
+      char *data = store(topic, payload);
+      m_pool->release(queued->data);
+      m_bytes -= queued->payload_size;
+      m_bytes += payload.size();
+      queued->data = data;
+      queued->payload_size = static_cast<uint32_t>(payload.size());
+      queued->qos = qos;
+      queued->retain = retain;
+      queued->id = m_next_id++;
+      // the replaced value has been waiting longer
+      if (queued->trace.origin == TraceStamp::NONE)
+        queued->trace = trace;
+      ++m_coalesced;
+      // a larger value may overflow the lane, evict the oldest other messages
+      while (m_bytes > m_max_bytes && m_count > 1) {
+        if (&at(0) == queued)
+          queued = requeue_front();
+        else
+          drop_front();
+      }
+      return;
+    }
+  }
+
+  if (m_policy == OverflowPolicy::DROP_NEWEST) {
+    if (m_bytes + size > m_max_bytes) {
+      ++m_dropped;
+      return;
+    }
+  } else {
+    while (!empty() && m_bytes + size > m_max_bytes) {
+      pop_front();
+      ++m_dropped;
+    }
+  }
+
+  if (m_count == m_ring.size())
+    grow();
+  const size_t position = (m_head + m_count) & (m_ring.size() - 1);
+  m_ring[position] = Entry{store(topic, payload), static_cast<uint32_t>(payload.size()),
+                           static_cast<uint16_t>(topic.size()), qos, retain, trace, hash,
+                           m_next_id++};
+  if (!m_index.empty())
+    index_insert(position, hash);
+  ++m_count;
+  m_bytes += size;
+}
+
+OutboundLane::Entry *OutboundLane::requeue_front() {
+  const Entry entry = at(0);
+  if (!m_index.empty())
+    index_erase(m_head, entry.hash);
+  m_head = (m_head + 1) & (m_ring.size() - 1);
+  // the slot after the last entry, the one just freed when the ring is full
+  const size_t position = (m_head + m_count - 1) & (m_ring.size() - 1);
+  m_ring[position] = entry;
+  if (!m_index.empty())
+    index_insert(position, entry.hash);
+  return &m_ring[position];
+}
+
+OutboundMessage OutboundLane::front() const {
+  const auto &entry = at(0);
+  return {std::string_view(entry.data, entry.topic_size),
+          std::string_view(entry.data + entry.topic_size, entry.payload_size), entry.qos,
+          entry.retain, entry.trace, homie::message_class::value, entry.id};
+}
+
+bool OutboundLane::pop_front(uint32_t id, bool dropped) {
+  if (empty() || at(0).id != id)
+    return false;
+  pop_front();
+  m_dropped += dropped;
+  return true;
+}
+
+void OutboundLane::pop_front() {
+  auto &entry = at(0);
+  if (!m_index.empty())
+    index_erase(m_head, entry.hash);
+  m_bytes -= entry.topic_size + entry.payload_size;
+  m_pool->release(entry.data);
+  entry.data = nullptr;
+  m_head = (m_head + 1) & (m_ring.size() - 1);
+  --m_count;
+}
+
+void OutboundQueue::reserve_pool(size_t size, size_t topic_size) {
+  using homie::message_class;
+  // rest of topic and payload of a typical message per lane, logs are batched
+  // lines and go to the largest class
+  constexpr std::array<size_t, LANE_COUNT> TYPICAL_REST = {
+      // $state + state
+      20,
+      // <node>/<property> + value
+      32,
+      // <node>/<property>/$<attribute> + value
+      64,
+      // $stats/<key> + value
+      24,
+      SIZE_MAX,
+  };
+  std::array<size_t, MessagePool::CLASS_COUNT> weights{};
+  for (size_t i = 0; i < LANE_COUNT; ++i) {
+    const size_t typical = TYPICAL_REST[i] == SIZE_MAX ? SIZE_MAX : topic_size + TYPICAL_REST[i];
+    size_t size_class = 0;
+    while (size_class + 1 < MessagePool::CLASS_COUNT &&
+           MessagePool::BLOCK_SIZES[size_class] < typical)
+      ++size_class;
+    weights[size_class] += m_lanes[i].max_bytes();
+  }
+  m_pool.reserve(size, weights);
+}
+
+OutboundQueue::OutboundQueue() {
+  for (auto &lane : m_lanes)
+    lane.set_pool(&m_pool);
+
+  using homie::message_class;
+  configure(message_class::state, 512, OverflowPolicy::DROP_OLDEST);
+  configure(message_class::value, 8 * 1024, OverflowPolicy::REPLACE);
+  configure(message_class::metadata, 16 * 1024, OverflowPolicy::REPLACE);
+  configure(message_class::stats, 1024, OverflowPolicy::REPLACE);
+  configure(message_class::log, 2 * 1024, OverflowPolicy::DROP_OLDEST);
+}
+
+size_t OutboundQueue::front_lane() const {
+  size_t index = 0;
+  while (index < LANE_COUNT && m_lanes[index].empty())
+    ++index;
+  return index;
+}
+
+bool OutboundQueue::empty() const { return front_lane() == LANE_COUNT; }
+
+size_t OutboundQueue::size() const {
+  size_t size = 0;
+  for (const auto &lane : m_lanes)
+    size += lane.size();
+  return size;
+}
+
+size_t OutboundQueue::bytes() const {
+  size_t bytes = 0;
+  for (const auto &lane : m_lanes)
+    bytes += lane.bytes();
+  return bytes;
+}
+
+uint32_t OutboundQueue::coalesced() const {
+  uint32_t coalesced = 0;
+  for (const auto &lane : m_lanes)
+    coalesced += lane.coalesced();
+  return coalesced;
+}
+
+OutboundMessage OutboundQueue::front() const {
+  const size_t index = front_lane();
+  auto message = m_lanes[index].front();
+  message.type = static_cast<homie::message_class>(index);
+  return message;
+}
+
+}  // namespace esphome::mqtt_homie
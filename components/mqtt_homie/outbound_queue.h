@@ -0,0 +1,181 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <vector>
+
+#include "homie-cpp.h"
+#include "latency_tracer.h"
+#include "message_pool.h"
+
+namespace esphome::mqtt_homie {
+
+enum class OverflowPolicy : uint8_t {
+  // coalesce queued messages by topic, evict the oldest message on overflow
+  REPLACE,
+  // FIFO, evict the oldest message on overflow
+  DROP_OLDEST,
+  // FIFO, reject the incoming message on overflow
+  DROP_NEWEST,
+};
+
+// Queued message, topic and payload stay valid until the message is popped
+struct OutboundMessage {
+  std::string_view topic;
+  std::string_view payload;
+  uint8_t qos;
+  bool retain;
+  TraceStamp trace;
+  // lane of the message, filled in by OutboundQueue::front()
+  homie::message_class type = homie::message_class::value;
+  // identifies the message in its lane, a newer value for the topic gets a new one
+  uint32_t id = 0;
+};
+
+// Single priority class of outbound messages with a byte cap. Topic and
+// payload of a message are stored back to back in one block of the pool.
+class OutboundLane {
+ public:
+  ~OutboundLane();
+
+  // must be set before the first push()
+  void set_pool(MessagePool *pool) { m_pool = pool; }
+  void configure(size_t max_bytes, OverflowPolicy policy) {
+    m_max_bytes = max_bytes;
+    m_policy = policy;
+  }
+  size_t max_bytes() const { return m_max_bytes; }
+
+  // Messages larger than the byte cap are dropped right away
+  void push(std::string_view topic, std::string_view payload, uint8_t qos, bool retain,
+            TraceStamp trace = {});
+
+  bool empty() const { return m_count == 0; }
+  size_t size() const { return m_count; }
+  size_t bytes() const { return m_bytes; }
+  uint32_t dropped() const { return m_dropped; }
+  // queued messages replaced by a newer one for the same topic
+  uint32_t coalesced() const { return m_coalesced; }
+
+  OutboundMessage front() const;
+  void pop_front();
+  // pops the oldest message and counts it as dropped
+  void drop_front() {
+    pop_front();
+    ++m_dropped;
+  }
+  // pops the oldest message if it still is the one with id
+  bool pop_front(uint32_t id, bool dropped);
+  uint32_t front_id() const { return at(0).id; }
+
+ private:
+  struct Entry {
+    char *data;
+    uint32_t payload_size;
+    uint16_t topic_size;
+    uint8_t qos;
+    bool retain;
+    TraceStamp trace;
+    // topic hash, REPLACE lanes only
+    uint32_t hash;
+    uint32_t id;
+  };
+
+  Entry &at(size_t index) { return m_ring[(m_head + index) & (m_ring.size() - 1)]; }
+  const Entry &at(size_t index) const { return m_ring[(m_head + index) & (m_ring.size() - 1)]; }
+  // queued message with this topic, REPLACE lanes only
+  Entry *find(std::string_view topic, uint32_t hash);
+  // Topic index of REPLACE lanes: open addressing with linear probing, slots
+  // hold the ring position + 1 of an entry, 0 marks a free slot. It has twice
+  // the slots of the ring and is rebuilt when the ring grows.
+  void index_insert(size_t position, uint32_t hash);
+  void index_erase(size_t position, uint32_t hash);
+  char *store(std::string_view topic, std::string_view payload);
+  void grow();
+  // moves the oldest message behind the newest one, returns its new entry
+  Entry *requeue_front();
+
+  MessagePool *m_pool = nullptr;
+  size_t m_max_bytes = 0;
+  size_t m_bytes = 0;
+  uint32_t m_dropped = 0;
+  uint32_t m_coalesced = 0;
+  uint32_t m_next_id = 0;
+  OverflowPolicy m_policy = OverflowPolicy::DROP_OLDEST;
+
+  // ring of entries, size is a power of two and only grows
+  std::vector<Entry> m_ring;
+  size_t m_head = 0;
+  size_t m_count = 0;
+  std::vector<uint32_t> m_index;
+};
+
+// Outbound message store with one lane per homie::message_class.
+// Messages are delivered from the highest priority non-empty lane first.
+class OutboundQueue {
+ public:
+  static constexpr size_t LANE_COUNT = static_cast<size_t>(homie::message_class::log) + 1;
+
+  OutboundQueue();
+  OutboundQueue(const OutboundQueue &) = delete;
+  OutboundQueue &operator=(const OutboundQueue &) = delete;
+
+  void configure(homie::message_class type, size_t max_bytes, OverflowPolicy policy) {
+    mutable_lane(type).configure(max_bytes, policy);
+  }
+  // Reserves the message pool, call before anything is queued and after the
+  // lanes are configured. The size classes get a share of size proportional
+  // to the byte caps of the lanes whose typical message (topic_size bytes of
+  // device topic plus the usual rest of topic and payload) falls into them.
+  void reserve_pool(size_t size, size_t topic_size);
+
+  void push(homie::message_class type, std::string_view topic, std::string_view payload,
+            uint8_t qos, bool retain, TraceStamp trace = {}) {
+    mutable_lane(type).push(topic, payload, qos, retain, trace);
+    m_peak_size = std::max(m_peak_size, size());
+  }
+
+  bool empty() const;
+  // messages in all lanes, and the most there ever were
+  size_t size() const;
+  size_t peak_size() const { return m_peak_size; }
+  size_t bytes() const;
+  uint32_t coalesced() const;
+  OutboundMessage front() const;
+  // Pops message, returned by front() earlier, when it still is the oldest of
+  // its lane and returns false when it was replaced or evicted meanwhile; the
+  // publisher task sends without holding the lock, the queue may change
+  // during a send. drop() counts the message as dropped in its lane.
+  bool pop(const OutboundMessage &message) {
+    return mutable_lane(message.type).pop_front(message.id, false);
+  }
+  bool drop(const OutboundMessage &message) {
+    return mutable_lane(message.type).pop_front(message.id, true);
+  }
+  // whether message still is the oldest of its lane
+  bool is_front(const OutboundMessage &message) const {
+    const auto &lane = m_lanes[static_cast<size_t>(message.type)];
+    return !lane.empty() && lane.front_id() == message.id;
+  }
+
+  const OutboundLane &lane(homie::message_class type) const {
+    return m_lanes[static_cast<size_t>(type)];
+  }
+  const MessagePool &pool() const { return m_pool; }
+
+ private:
+  OutboundLane &mutable_lane(homie::message_class type) {
+    return m_lanes[static_cast<size_t>(type)];
+  }
+  // index of the highest priority non-empty lane, LANE_COUNT when all are empty
+  size_t front_lane() const;
+
+  MessagePool m_pool;
+  std::array<OutboundLane, LANE_COUNT> m_lanes;
+  size_t m_peak_size = 0;
+};
+
+}  // namespace esphome::mqtt_homie
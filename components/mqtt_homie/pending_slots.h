@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome::mqtt_homie {
+
+// Flags per property slot, set from any task and collected by a single
+// consumer. Flags set again before they are taken merge into the pending
+// ones, so however many notifications arrive between two passes none is
+// lost and setting never blocks or allocates.
+class PendingSlots {
+ public:
+  static constexpr uint8_t FLAG_COUNT = 3;
+
+  // Sizes the set for slots, keeps pending flags. Not safe against
+  // concurrent set(), call during setup.
+  void resize(size_t slots) {
+    const size_t words = (slots + 31) / 32;
+    if (words == m_words_per_flag)
+      return;
+    std::vector<std::atomic<uint32_t>> bits(words * FLAG_COUNT);
+    for (size_t flag = 0; flag < FLAG_COUNT; ++flag) {
+      for (size_t word = 0; word < words && word < m_words_per_flag; ++word)
+        bits[flag * words + word].store(m_bits[flag * m_words_per_flag + word].load());
+    }
+    m_bits.swap(bits);
+    m_words_per_flag = words;
+  }
+  size_t capacity() const { return m_words_per_flag * 32; }
+
+  // Sets flags (bit i of flags is flag i) on count slots starting at first,
+  // may run on any task
+  void set(size_t first, size_t count, uint8_t flags) {
+    const size_t end = first + count;
+    if (count == 0 || end > capacity())
+      return;
+    for (size_t word = first / 32; word * 32 < end; ++word) {
+      const size_t from = word * 32 > first ? 0 : first % 32;
+      const size_t to = (word + 1) * 32 < end ? 32 : end - word * 32;
+      const uint32_t mask = (to - from == 32 ? ~0u : ((1u << (to - from)) - 1)) << from;
+      for (size_t flag = 0; flag < FLAG_COUNT; ++flag) {
+        if (flags & (1u << flag))
+          m_bits[flag * m_words_per_flag + word].fetch_or(mask, std::memory_order_relaxed);
+      }
+    }
+    m_any.store(true, std::memory_order_release);
+  }
+
+  // Consumer side: clears all pending slots and calls fn(slot, flags) for
+  // each of them in slot order. The flags of one set() may be split over two
+  // consecutive take() calls.
+  template<typename F> void take(F &&fn) {
+    if (!m_any.exchange(false, std::memory_order_acquire))
+      return;
+    for (size_t word = 0; word < m_words_per_flag; ++word) {
+      uint32_t flag_bits[FLAG_COUNT];
+      uint32_t bits = 0;
+      for (size_t flag = 0; flag < FLAG_COUNT; ++flag) {
+        auto &pending = m_bits[flag * m_words_per_flag + word];
+        flag_bits[flag] = pending.exchange(0, std::memory_order_relaxed);
+        bits |= flag_bits[flag];
+      }
+      while (bits != 0) {
+        const size_t bit = __builtin_ctz(bits);
+        bits &= bits - 1;
+        uint8_t flags = 0;
+        for (size_t flag = 0; flag < FLAG_COUNT; ++flag)
+          flags |= ((flag_bits[flag] >> bit) & 1u) << flag;
+        fn(word * 32 + bit, flags);
+      }
+    }
+  }
+
+ private:
+  // FLAG_COUNT arrays of m_words_per_flag words
+  std::vector<std::atomic<uint32_t>> m_bits;
+  size_t m_words_per_flag = 0;
+  // a slot was set since the last take()
+  std::atomic<bool> m_any{false};
+};
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,78 @@
+#include "publish_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace esphome::mqtt_homie {
+
+static bool read_number(const homie::property &property, float &value) {
+  homie::typed_value typed;
+  if (!property.get_typed_value(typed))
+    return false;
+  switch (typed.type) {
+    case homie::datatype::number:
+      value = static_cast<float>(typed.number);
+      return true;
+    case homie::datatype::integer:
+      value = static_cast<float>(typed.integer);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void PublishLimiter::record(State &state, const homie::property &property, uint32_t now) {
+  state.numeric = read_number(property, state.value);
+  state.published_ms = now;
+  state.published = true;
+  state.pending = false;
+}
+
+bool PublishLimiter::on_change(size_t index, const homie::property &property, uint32_t now) {
+  auto &state = m_states[index];
+  if (!state.published) {
+    record(state, property, now);
+    return true;
+  }
+
+  float value;
+  if (m_policy.deadband > 0 && state.numeric && read_number(property, value)) {
+    const float band =
+        m_policy.deadband_relative ? m_policy.deadband * std::fabs(state.value) : m_policy.deadband;
+    // NaN never compares less, so state changes from and to NaN pass
+    if (std::fabs(value - state.value) < band)
+      return false;
+  }
+
+  if (m_policy.min_interval_ms != 0 && now - state.published_ms < m_policy.min_interval_ms) {
+    state.pending = true;
+    return false;
+  }
+
+  record(state, property, now);
+  return true;
+}
+
+bool PublishLimiter::is_due(size_t index, const homie::property &property, uint32_t now) {
+  auto &state = m_states[index];
+  const uint32_t elapsed = now - state.published_ms;
+  const bool due = (state.pending && elapsed >= m_policy.min_interval_ms) ||
+                   (m_policy.heartbeat_ms != 0 && elapsed >= m_policy.heartbeat_ms);
+  if (due)
+    record(state, property, now);
+  return due;
+}
+
+uint32_t PublishLimiter::due_in(size_t index, uint32_t now) const {
+  const auto &state = m_states[index];
+  const uint32_t elapsed = now - state.published_ms;
+  auto remaining = [elapsed](uint32_t period) { return elapsed >= period ? 0 : period - elapsed; };
+  uint32_t due = UINT32_MAX;
+  if (state.pending)
+    due = remaining(m_policy.min_interval_ms);
+  if (m_policy.heartbeat_ms != 0)
+    due = std::min(due, remaining(m_policy.heartbeat_ms));
+  return due;
+}
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "homie-cpp.h"
+
+namespace esphome::mqtt_homie {
+
+// Per entity publish limits from the controller schema, 0 disables a limit
+struct PublishPolicy {
+  // changes of numeric values smaller than this are not published
+  float deadband = 0;
+  // deadband is a fraction of the last published value
+  bool deadband_relative = false;
+  // changes arriving earlier are published once the interval has passed
+  uint32_t min_interval_ms = 0;
+  // value is republished after this long without a publish
+  uint32_t heartbeat_ms = 0;
+};
+
+// Applies a PublishPolicy to the properties of one node, indexed like the
+// node's properties
+class PublishLimiter {
+ public:
+  PublishLimiter(const PublishPolicy &policy, size_t property_count)
+      : m_policy(policy), m_states(property_count) {}
+
+  // Called on a state change, returns true when it is to be published now
+  bool on_change(size_t index, const homie::property &property, uint32_t now);
+  // Called periodically, returns true when a held back change or a heartbeat is due
+  bool is_due(size_t index, const homie::property &property, uint32_t now);
+  // Milliseconds until is_due() returns true, UINT32_MAX when nothing is scheduled
+  uint32_t due_in(size_t index, uint32_t now) const;
+
+  size_t size() const { return m_states.size(); }
+
+ private:
+  struct State {
+    float value = 0;
+    uint32_t published_ms = 0;
+    bool numeric = false;
+    bool published = false;
+    // change held back by min_interval_ms
+    bool pending = false;
+  };
+
+  void record(State &state, const homie::property &property, uint32_t now);
+
+  const PublishPolicy m_policy;
+  std::vector<State> m_states;
+};
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,104 @@
+#include "publisher_task.h"
+
+#include "esphome/core/log.h"
+
+namespace esphome::mqtt_homie {
+
+static const char *const TAG = "homie:publisher";
+
+#ifdef USE_ESP32
+
+PublisherTask::~PublisherTask() {
+  if (m_handle)
+    vTaskDelete(m_handle);
+}
+
+bool PublisherTask::start(std::function<uint32_t()> work) {
+  m_work = std::move(work);
+  const BaseType_t created = xTaskCreatePinnedToCore(
+      [](void *arg) { static_cast<PublisherTask *>(arg)->run(); }, "homie_publisher",
+      m_stack_size, this, m_priority, &m_handle, m_core);
+  if (created != pdPASS) {
+    ESP_LOGE(TAG, "Cannot create publisher task");
+    m_handle = nullptr;
+    return false;
+  }
+  m_running = true;
+  ESP_LOGI(TAG, "Publisher task running on core %d", m_core);
+  return true;
+}
+
+void PublisherTask::wake() {
+  if (m_handle)
+    xTaskNotifyGive(m_handle);
+}
+
+void PublisherTask::run() {
+  while (true) {
+    const uint32_t wait_ms = m_work();
+    ulTaskNotifyTake(pdTRUE, wait_ms == IDLE ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms));
+  }
+}
+
+#elif defined(USE_HOST)
+
+PublisherTask::~PublisherTask() {
+  if (!m_thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+bool PublisherTask::start(std::function<uint32_t()> work) {
+  m_work = std::move(work);
+  m_thread = std::thread([this] { run(); });
+  m_running = true;
+  ESP_LOGI(TAG, "Publisher thread running");
+  return true;
+}
+
+void PublisherTask::wake() {
+  // the flag is set under the mutex, an idle thread may sleep for good and
+  // must not miss it; the mutex is only held around the flags
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_woken = true;
+  }
+  m_wake.notify_one();
+}
+
+void PublisherTask::run() {
+  while (true) {
+    const uint32_t wait_ms = m_work();
+    std::unique_lock<std::mutex> lock(m_wake_mutex);
+    // an idle thread runs the work again once a day at the latest, which
+    // does no harm
+    const std::chrono::milliseconds timeout =
+        wait_ms == IDLE ? std::chrono::hours(24) : std::chrono::milliseconds(wait_ms);
+    m_wake.wait_for(lock, timeout, [this] { return m_woken || m_stop; });
+    if (m_stop)
+      return;
+    m_woken = false;
+  }
+}
+
+#else
+
+PublisherTask::~PublisherTask() = default;
+
+bool PublisherTask::start(std::function<uint32_t()> work) {
+  ESP_LOGE(TAG, "Publisher task is not supported on this platform");
+  return false;
+}
+
+void PublisherTask::wake() {}
+
+void PublisherTask::run() {}
+
+#endif
+
+}  // namespace esphome::mqtt_homie
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#elif defined(USE_HOST)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace esphome::mqtt_homie {
+
+// Optional task that takes serialization and the MQTT handoff off the main
+// loop: a pinned FreeRTOS task on ESP32, a std::thread on the host platform
+// (used by the host tests). It sleeps until wake() or until the time the
+// last run of the work asked for. The work takes mutex() itself, only around
+// the handoff of single messages and never across a send; main loop code that
+// calls into the Homie client (MQTT callbacks, timers, state transitions)
+// takes the same mutex via lock_publisher().
+//
+// The work may only publish: MQTTClientComponent::publish() is called from
+// the task, which is safe with the ESP-IDF MQTT client on ESP32 only.
+// Subscriptions, scheduler calls and preferences stay on the main loop.
+class PublisherTask {
+ public:
+  // returned by the work to sleep until the next wake()
+  static constexpr uint32_t IDLE = UINT32_MAX;
+
+  PublisherTask(int core, int priority, uint32_t stack_size)
+      : m_core(core), m_priority(priority), m_stack_size(stack_size) {}
+  PublisherTask(const PublisherTask &) = delete;
+  PublisherTask &operator=(const PublisherTask &) = delete;
+  ~PublisherTask();
+
+  // Runs work once, then whenever wake() is called and after the number of
+  // milliseconds work returned unless that is IDLE. Returns false when the
+  // task could not be created or the platform has no task support.
+  bool start(std::function<uint32_t()> work);
+  bool is_running() const { return m_running; }
+  // Safe from any task, never blocks on ESP32
+  void wake();
+
+  Mutex &mutex() { return m_mutex; }
+
+ private:
+  void run();
+
+  int m_core;
+  int m_priority;
+  uint32_t m_stack_size;
+  std::function<uint32_t()> m_work;
+  Mutex m_mutex;
+  bool m_running = false;
+
+#ifdef USE_ESP32
+  TaskHandle_t m_handle = nullptr;
+#elif defined(USE_HOST)
+  std::thread m_thread;
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+  // guarded by m_wake_mutex
+  bool m_woken = false;
+  bool m_stop = false;
+#endif
+};
+
+// Holds the publisher task's mutex, or nothing when there is no publisher task
+inline std::unique_lock<Mutex> lock_publisher(PublisherTask *publisher) {
+  return publisher ? std::unique_lock<Mutex>(publisher->mutex()) : std::unique_lock<Mutex>();
+}
+
+// Takes the publisher task's mutex into lock unless the task holds it right
+// now, returns false then. Always succeeds when there is no publisher task.
+inline bool try_lock_publisher(PublisherTask *publisher, std::unique_lock<Mutex> &lock) {
+  if (!publisher)
+    return true;
+  lock = std::unique_lock<Mutex>(publisher->mutex(), std::try_to_lock);
+  return lock.owns_lock();
+}
+
+}  // namespace esphome::mqtt_homie
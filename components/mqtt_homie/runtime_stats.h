@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome::mqtt_homie {
+
+// Counters for the extended $stats, collected by HomieClient and reported
+// and reset by HomieDevice once per stats interval
+struct RuntimeStats {
+  // messages and bytes (topic and payload) handed to the MQTT client
+  uint32_t sent_messages = 0;
+  uint32_t sent_bytes = 0;
+  // time spent per pass of the publishing work, device processing included
+  uint32_t loop_count = 0;
+  uint32_t loop_us_total = 0;
+  uint32_t loop_us_max = 0;
+
+  void on_sent(size_t bytes) {
+    ++sent_messages;
+    sent_bytes += bytes;
+  }
+  void on_loop(uint32_t us) {
+    ++loop_count;
+    loop_us_total += us;
+    loop_us_max = std::max(loop_us_max, us);
+  }
+  uint32_t loop_us_average() const { return loop_count != 0 ? loop_us_total / loop_count : 0; }
+  void reset() { *this = RuntimeStats{}; }
+};
+
+}  // namespace esphome::mqtt_homie
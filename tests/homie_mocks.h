@@ -0,0 +1,160 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "homie-cpp/client.h"
+
+// Minimal homie device model and MQTT transport for host tests
+
+namespace homie_test {
+
+class mock_property : public homie::property {
+ public:
+  mock_property(std::string_view id, homie::datatype type, std::string_view format = {},
+                bool settable = true)
+      : id(id), type(type), format(format), settable(settable) {}
+
+  std::string_view get_id() const override { return id; }
+  std::string_view get_name() const override { return id; }
+  bool is_settable() const override { return settable; }
+  bool is_retained() const override { return true; }
+  std::string_view get_unit() const override { return {}; }
+  homie::datatype get_datatype() const override { return type; }
+  std::string_view get_format() const override { return format; }
+
+  std::string get_value(int64_t) const override { return get_value(); }
+  void set_value(int64_t, const std::string &v) override { set_value(v); }
+  std::string get_value() const override { return value; }
+  void set_value(const std::string &v) override {
+    value = v;
+    ++string_sets;
+  }
+  void for_each_attribute(homie::attribute_visitor) const override {}
+
+  bool get_typed_value(homie::typed_value &v) const override {
+    if (!typed)
+      return false;
+    v = current;
+    return true;
+  }
+  bool set_typed_value(const homie::typed_value &v) override {
+    if (!typed || !typed_set_accepted)
+      return false;
+    current = v;
+    ++typed_sets;
+    return true;
+  }
+
+  std::string_view id;
+  homie::datatype type;
+  std::string_view format;
+  bool settable;
+  // answer the typed fast path
+  bool typed = true;
+  // set_typed_value() applies the value, false leaves it to set_value()
+  bool typed_set_accepted = true;
+  homie::typed_value current;
+  std::string value;
+  size_t typed_sets = 0;
+  size_t string_sets = 0;
+};
+
+class mock_node : public homie::node {
+ public:
+  explicit mock_node(std::string_view id) : id(id) {}
+
+  std::string_view get_id() const override { return id; }
+  std::string_view get_name() const override { return id; }
+  std::string get_name(int64_t) const override { return std::string(id); }
+  std::string_view get_type() const override { return {}; }
+  bool is_array() const override { return false; }
+  std::pair<int64_t, int64_t> array_range() const override { return {0, 0}; }
+  size_t get_property_count() const override { return properties.size(); }
+  homie::const_property_ptr get_property_at(size_t i) const override { return properties[i]; }
+  homie::property_ptr get_property_at(size_t i) override { return properties[i]; }
+  homie::const_property_ptr get_property(std::string_view id) const override {
+    for (auto p : properties)
+      if (p->get_id() == id)
+        return p;
+    return nullptr;
+  }
+  homie::property_ptr get_property(std::string_view id) override {
+    for (auto p : properties)
+      if (p->get_id() == id)
+        return p;
+    return nullptr;
+  }
+  void for_each_attribute(homie::attribute_visitor) const override {}
+
+  std::string_view id;
+  std::vector<homie::property_ptr> properties;
+};
+
+class mock_device : public homie::device {
+ public:
+  explicit mock_device(std::string id) : id(std::move(id)) {}
+
+  const std::string &get_id() const override { return id; }
+  const std::string &get_name() const override { return id; }
+  size_t get_node_count() const override { return nodes.size(); }
+  homie::node_ptr get_node_at(size_t i) override { return nodes[i]; }
+  homie::const_node_ptr get_node_at(size_t i) const override { return nodes[i]; }
+  homie::node_ptr get_node(std::string_view id) override {
+    for (auto n : nodes)
+      if (n->get_id() == id)
+        return n;
+    return nullptr;
+  }
+  homie::const_node_ptr get_node(std::string_view id) const override {
+    for (auto n : nodes)
+      if (n->get_id() == id)
+        return n;
+    return nullptr;
+  }
+  void for_each_attribute(homie::attribute_visitor) const override {}
+  void for_each_stat(homie::attribute_visitor) const override {}
+  homie::device_state get_state() const override { return homie::device_state::ready; }
+
+  std::string id;
+  std::vector<homie::node_ptr> nodes;
+};
+
+// Counts set callbacks
+class mock_handler : public homie::client_event_handler {
+ public:
+  void on_broadcast(const std::string &, const std::string &) override {}
+  void on_property_set(const homie::node *, const homie::property *) override { ++sets; }
+
+  size_t sets = 0;
+};
+
+// Records everything published, hands inbound messages to the client
+class mock_mqtt : public homie::mqtt_client {
+ public:
+  struct message {
+    std::string topic;
+    std::string payload;
+    homie::message_class type;
+  };
+
+  void set_event_handler(homie::mqtt_event_handler *evt) override { handler = evt; }
+  void open(const std::string &, const std::string &, int, bool) override {}
+  void publish(std::string_view topic, std::string_view payload, int, bool,
+               homie::message_class type) override {
+    published.push_back({std::string(topic), std::string(payload), type});
+  }
+  void subscribe(const std::string &topic, int) override { subscriptions.push_back(topic); }
+  void unsubscribe(const std::string &) override {}
+  bool is_connected() const override { return true; }
+
+  void deliver(const std::string &topic, const std::string &payload) {
+    handler->on_message(topic, payload);
+  }
+
+  homie::mqtt_event_handler *handler = nullptr;
+  std::vector<message> published;
+  std::vector<std::string> subscriptions;
+};
+
+}  // namespace homie_test
@@ -0,0 +1,85 @@
+// Log lines from any task to $log batches: prefixes, truncation, the ingress
+// ring sized from the buffer and counted overflows
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "log_forwarder.h"
+
+namespace {
+
+using esphome::mqtt_homie::LogForwarder;
+
+class LogForwarderTest : public ::testing::Test {
+ protected:
+  void configure(size_t buffer_size) { forwarder.configure(buffer_size, 1000, 0, 0); }
+  // flushes once the interval passed and returns the published batch
+  std::string flush() {
+    std::string batch;
+    now += 1000;
+    forwarder.flush(now, [&batch](std::string_view payload) { batch = payload; });
+    return batch;
+  }
+
+  LogForwarder forwarder;
+  uint32_t now = 0;
+};
+
+TEST_F(LogForwarderTest, PrefixesAndBatchesLines) {
+  configure(1024);
+  forwarder.set_level(6);
+  forwarder.push(2, "wifi", "\033[0;33mDisconnected\033[0m");
+  forwarder.push(3, "app", "[I][app:100]: Running");
+  EXPECT_EQ(flush(), "[W][wifi]: Disconnected\n[I][app:100]: Running");
+  EXPECT_EQ(flush(), "");
+}
+
+TEST_F(LogForwarderTest, FlushDueOnlyWithLines) {
+  configure(1024);
+  forwarder.set_level(3);
+  EXPECT_FALSE(forwarder.push(5, "test", "filtered"));
+  flush();
+  EXPECT_EQ(forwarder.flush_due_in(now), UINT32_MAX);
+
+  EXPECT_TRUE(forwarder.push(2, "test", "kept"));
+  // taken by a flush before the interval passed
+  forwarder.flush(now + 400, [](std::string_view) {});
+  EXPECT_EQ(forwarder.flush_due_in(now + 400), 600u);
+  EXPECT_EQ(forwarder.flush_due_in(now + 1500), 0u);
+  EXPECT_EQ(flush(), "[W][test]: kept");
+  EXPECT_EQ(forwarder.flush_due_in(now), UINT32_MAX);
+}
+
+TEST_F(LogForwarderTest, IngressFollowsBufferSize) {
+  // many more and longer lines per loop than a fixed ingress of small lines
+  configure(8192);
+  forwarder.set_level(6);
+  const std::string line = "[D][test]: " + std::string(400, 'x');
+  for (int i = 0; i < 15; ++i)
+    forwarder.push(5, "test", line.c_str());
+  const std::string batch = flush();
+  EXPECT_EQ(batch.size(), 15 * (line.size() + 1) - 1);
+  EXPECT_EQ(forwarder.suppressed().total(), 0u);
+}
+
+TEST_F(LogForwarderTest, MarksTruncatedLines) {
+  configure(256);
+  forwarder.set_level(6);
+  forwarder.push(5, "test", std::string(100, 'y').c_str());
+  // a quarter of the buffer: prefix plus 61 characters and the marker
+  EXPECT_EQ(flush(), "[D][test]: " + std::string(61, 'y') + "...");
+}
+
+TEST_F(LogForwarderTest, CountsOverflow) {
+  configure(256);
+  forwarder.set_level(6);
+  for (int i = 0; i < 20; ++i)
+    forwarder.push(5, "test", "0123456789012345678901234567890123456789");
+  const std::string batch = flush();
+  EXPECT_GT(forwarder.suppressed().overflow, 0u);
+  EXPECT_NE(batch.find(" log lines suppressed"), std::string::npos);
+}
+
+}  // namespace
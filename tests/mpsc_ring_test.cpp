@@ -0,0 +1,98 @@
+// Lock-free byte ring between logger callbacks on any task and the main loop:
+// records wrap intact, and several producer threads against one consumer
+// lose nothing but what is counted as dropped
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mpsc_ring.h"
+
+namespace {
+
+using esphome::mqtt_homie::MpscByteRing;
+
+constexpr int PRODUCERS = 8;
+constexpr uint32_t PER_PRODUCER = 5000;
+
+TEST(MpscByteRingTest, RecordsWrapWithPadding) {
+  MpscByteRing ring;
+  ring.reserve(60);
+  EXPECT_EQ(ring.capacity(), 64u);
+  std::string popped;
+  auto pop = [&] {
+    return ring.try_pop([&](const char *data, size_t length) { popped.assign(data, length); });
+  };
+  // 4 + 20 bytes each, the third one does not fit behind the second
+  for (int round = 0; round < 10; ++round) {
+    const std::string text = "record " + std::to_string(round) + std::string(round, '.');
+    ASSERT_TRUE(ring.try_push(text.size(), [&](char *data) { text.copy(data, text.size()); }));
+    ASSERT_TRUE(pop());
+    EXPECT_EQ(popped, text);
+    EXPECT_FALSE(pop());
+  }
+  EXPECT_FALSE(ring.try_push(ring.max_record() + 1, [](char *) {}));
+  EXPECT_EQ(ring.dropped(), 1u);
+}
+
+TEST(MpscByteRingTest, ProducersAgainstOneConsumer) {
+  MpscByteRing ring;
+  ring.reserve(1024);
+  std::atomic<int> finished{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < PRODUCERS; ++p) {
+    producers.emplace_back([&, p] {
+      for (uint32_t i = 0; i < PER_PRODUCER; ++i) {
+        // "<producer>/<sequence>" plus a varying tail of the same character
+        char text[64];
+        const int length = std::snprintf(text, sizeof(text), "%d/%u/", p, i);
+        const size_t size = length + i % 37;
+        std::memset(text + length, 'a' + i % 26, size - length);
+        ring.try_push(size, [&](char *data) { std::memcpy(data, text, size); });
+        if (i % 4 != 0)
+          std::this_thread::yield();
+      }
+      ++finished;
+    });
+  }
+
+  std::vector<int64_t> last(PRODUCERS, -1);
+  uint64_t received = 0;
+  bool intact = true, ordered = true;
+  auto pop = [&] {
+    return ring.try_pop([&](const char *data, size_t size) {
+      unsigned producer = 0, sequence = 0;
+      int length = 0;
+      const std::string text(data, size);
+      if (std::sscanf(text.c_str(), "%u/%u/%n", &producer, &sequence, &length) != 2 ||
+          producer >= PRODUCERS || size != length + sequence % 37 ||
+          text.find_first_not_of(char('a' + sequence % 26), length) != std::string::npos) {
+        intact = false;
+        return;
+      }
+      ordered &= static_cast<int64_t>(sequence) > last[producer];
+      last[producer] = sequence;
+      ++received;
+    });
+  };
+  while (finished < PRODUCERS)
+    pop();
+  for (auto &producer : producers)
+    producer.join();
+  while (pop()) {
+  }
+
+  EXPECT_TRUE(intact);
+  EXPECT_TRUE(ordered);
+  EXPECT_GT(received, 0u);
+  EXPECT_EQ(received + ring.dropped(), uint64_t(PRODUCERS) * PER_PRODUCER);
+  std::printf("received %llu, dropped %u\n", static_cast<unsigned long long>(received),
+              ring.dropped());
+}
+
+}  // namespace
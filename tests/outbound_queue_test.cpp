@@ -0,0 +1,190 @@
+// Outbound lanes and their message pool: topic index and eviction of REPLACE
+// lanes, oversize messages, messages changed during a send and pool size classes
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "outbound_queue.h"
+
+namespace {
+
+using esphome::mqtt_homie::MessagePool;
+using esphome::mqtt_homie::OutboundLane;
+using esphome::mqtt_homie::OutboundMessage;
+using esphome::mqtt_homie::OutboundQueue;
+using esphome::mqtt_homie::OverflowPolicy;
+using homie::message_class;
+
+std::string topic_of(int i) { return "homie/dev/node" + std::to_string(i) + "/value"; }
+
+TEST(OutboundLaneTest, ReplaceKeepsOneMessagePerTopicInOrder) {
+  MessagePool pool;
+  OutboundLane lane;
+  lane.set_pool(&pool);
+  lane.configure(1 << 20, OverflowPolicy::REPLACE);
+
+  // enough topics to grow the ring and its index several times
+  constexpr int TOPICS = 300;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < TOPICS; ++i)
+      lane.push(topic_of(i), std::to_string(round * TOPICS + i), 0, false);
+  }
+  ASSERT_EQ(lane.size(), size_t(TOPICS));
+  EXPECT_EQ(lane.coalesced(), uint32_t(2 * TOPICS));
+  for (int i = 0; i < TOPICS; ++i) {
+    const OutboundMessage message = lane.front();
+    EXPECT_EQ(message.topic, topic_of(i));
+    EXPECT_EQ(message.payload, std::to_string(2 * TOPICS + i));
+    lane.pop_front();
+  }
+  EXPECT_TRUE(lane.empty());
+}
+
+TEST(OutboundLaneTest, IndexFollowsRandomPushAndPop) {
+  MessagePool pool;
+  OutboundLane lane;
+  lane.set_pool(&pool);
+  lane.configure(1 << 20, OverflowPolicy::REPLACE);
+
+  // reference model: queued topics in order and their latest payloads
+  std::vector<int> order;
+  std::map<int, std::string> latest;
+  std::mt19937 random(1);
+  for (int step = 0; step < 50000; ++step) {
+    if (random() % 3 != 0) {
+      const int topic = random() % 97;
+      const std::string payload = std::to_string(step);
+      lane.push(topic_of(topic), payload, 0, false);
+      if (!latest.count(topic))
+        order.push_back(topic);
+      latest[topic] = payload;
+    } else if (!order.empty()) {
+      const OutboundMessage message = lane.front();
+      ASSERT_EQ(message.topic, topic_of(order.front()));
+      ASSERT_EQ(message.payload, latest[order.front()]);
+      latest.erase(order.front());
+      order.erase(order.begin());
+      lane.pop_front();
+    }
+    ASSERT_EQ(lane.size(), order.size());
+  }
+}
+
+TEST(OutboundLaneTest, FifoLanesDoNotCoalesce) {
+  MessagePool pool;
+  OutboundLane lane;
+  lane.set_pool(&pool);
+  lane.configure(1 << 20, OverflowPolicy::DROP_OLDEST);
+  for (int i = 0; i < 20; ++i)
+    lane.push(topic_of(0), std::to_string(i), 0, false);
+  EXPECT_EQ(lane.size(), 20u);
+  EXPECT_EQ(lane.coalesced(), 0u);
+}
+
+TEST(OutboundLaneTest, ReplaceNeverEvictsTheRefreshedMessage) {
+  MessagePool pool;
+  OutboundLane lane;
+  lane.set_pool(&pool);
+  const size_t message = topic_of(0).size() + 4;
+  lane.configure(3 * message, OverflowPolicy::REPLACE);
+  for (int i = 0; i < 3; ++i)
+    lane.push(topic_of(i), "1111", 0, false);
+
+  // the oldest message grows, the others have to make room for it
+  const std::string large(message + 8, '2');
+  lane.push(topic_of(0), large, 0, false);
+  EXPECT_EQ(lane.dropped(), 2u);
+  ASSERT_EQ(lane.size(), 1u);
+  EXPECT_EQ(lane.front().topic, topic_of(0));
+  EXPECT_EQ(lane.front().payload, large);
+  lane.pop_front();
+
+  // a refreshed message in the middle is kept as well
+  for (int i = 0; i < 3; ++i)
+    lane.push(topic_of(i), "1111", 0, false);
+  lane.push(topic_of(1), "222222", 0, false);
+  EXPECT_EQ(lane.dropped(), 3u);
+  ASSERT_EQ(lane.size(), 2u);
+  EXPECT_EQ(lane.front().topic, topic_of(1));
+  lane.pop_front();
+  EXPECT_EQ(lane.front().topic, topic_of(2));
+}
+
+TEST(OutboundLaneTest, OversizeMessageIsRejected) {
+  for (auto policy :
+       {OverflowPolicy::REPLACE, OverflowPolicy::DROP_OLDEST, OverflowPolicy::DROP_NEWEST}) {
+    MessagePool pool;
+    OutboundLane lane;
+    lane.set_pool(&pool);
+    lane.configure(64, policy);
+    lane.push(topic_of(0), "1", 0, false);
+    lane.push(topic_of(1), std::string(64, 'x'), 0, false);
+    EXPECT_EQ(lane.dropped(), 1u);
+    // nothing was evicted for it
+    ASSERT_EQ(lane.size(), 1u);
+    EXPECT_EQ(lane.front().topic, topic_of(0));
+  }
+}
+
+TEST(OutboundQueueTest, PopLeavesMessagesReplacedDuringTheSend) {
+  OutboundQueue queue;
+  queue.push(message_class::value, topic_of(0), "1", 0, false);
+  const OutboundMessage sending = queue.front();
+  // a newer value for the topic arrives while the first one is sent
+  queue.push(message_class::value, topic_of(0), "2", 0, false);
+  EXPECT_FALSE(queue.is_front(sending));
+  EXPECT_FALSE(queue.pop(sending));
+  ASSERT_EQ(queue.size(), 1u);
+
+  const OutboundMessage newer = queue.front();
+  EXPECT_EQ(newer.payload, "2");
+  EXPECT_TRUE(queue.is_front(newer));
+  EXPECT_TRUE(queue.drop(newer));
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.lane(message_class::value).dropped(), 1u);
+}
+
+TEST(MessagePoolTest, WeightsSplitTheArena) {
+  MessagePool pool;
+  pool.reserve(4096, {0, 3, 1, 0, 0});
+  EXPECT_EQ(pool.capacity(), 4096u);
+  // 48 blocks of 64 bytes, 8 of 128 bytes
+  for (int i = 0; i < 48; ++i)
+    pool.allocate(40);
+  EXPECT_EQ(pool.used(), 48u * 64);
+  pool.allocate(40);
+  EXPECT_EQ(pool.used(), 48u * 64 + 128);
+  EXPECT_EQ(pool.fallbacks(), 0u);
+}
+
+TEST(OutboundQueueTest, PoolFollowsLaneCaps) {
+  // 50 byte value messages below "homie/dev/"
+  const std::string payload = "12.5";
+  auto value_topic = [](int i) {
+    return "homie/dev/living_room_sensor_" + std::to_string(i) + "/value";
+  };
+  constexpr int MESSAGES = 75;
+
+  OutboundQueue queue;
+  queue.reserve_pool(8192, 10);
+  EXPECT_GT(queue.pool().capacity(), 8192u - 512);
+  for (int i = 0; i < MESSAGES; ++i)
+    queue.push(message_class::value, value_topic(i), payload, 0, false);
+  EXPECT_EQ(queue.pool().fallbacks(), 0u);
+
+  // an even split of the same arena has too few blocks of 64 bytes and more
+  MessagePool even;
+  even.reserve(8192);
+  std::vector<char *> blocks;
+  for (int i = 0; i < MESSAGES; ++i)
+    blocks.push_back(even.allocate(value_topic(i).size() + payload.size()));
+  EXPECT_GT(even.fallbacks(), 0u);
+  for (char *block : blocks)
+    even.release(block);
+}
+
+}  // namespace
@@ -0,0 +1,102 @@
+// Property notifications from any task: flags of a slot merge until the
+// consumer takes them, so nothing is lost however many arrive per pass
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "pending_slots.h"
+
+namespace {
+
+using esphome::mqtt_homie::PendingSlots;
+
+// (slot, flags) pairs of one take()
+std::vector<std::pair<size_t, uint8_t>> take_all(PendingSlots &slots) {
+  std::vector<std::pair<size_t, uint8_t>> taken;
+  slots.take([&taken](size_t slot, uint8_t flags) { taken.emplace_back(slot, flags); });
+  return taken;
+}
+
+TEST(PendingSlotsTest, FlagsMergeUntilTaken) {
+  PendingSlots slots;
+  slots.resize(40);
+  EXPECT_EQ(slots.capacity(), 64u);
+  // far more notifications than a pass used to hold
+  for (int i = 0; i < 1000; ++i)
+    slots.set(i % 40, 1, 1);
+  slots.set(3, 1, 4);
+  auto taken = take_all(slots);
+  ASSERT_EQ(taken.size(), 40u);
+  for (size_t slot = 0; slot < taken.size(); ++slot) {
+    EXPECT_EQ(taken[slot].first, slot);
+    EXPECT_EQ(taken[slot].second, slot == 3 ? 5 : 1);
+  }
+  EXPECT_TRUE(take_all(slots).empty());
+}
+
+TEST(PendingSlotsTest, RangesCrossWords) {
+  PendingSlots slots;
+  slots.resize(100);
+  slots.set(30, 40, 2);
+  slots.set(0, 32, 1);
+  // out of range, ignored
+  slots.set(90, 40, 1);
+  auto taken = take_all(slots);
+  ASSERT_EQ(taken.size(), 70u);
+  EXPECT_EQ(taken.front(), std::make_pair(size_t(0), uint8_t(1)));
+  EXPECT_EQ(taken[30], std::make_pair(size_t(30), uint8_t(3)));
+  EXPECT_EQ(taken.back(), std::make_pair(size_t(69), uint8_t(2)));
+}
+
+TEST(PendingSlotsTest, ResizeKeepsPendingFlags) {
+  PendingSlots slots;
+  slots.resize(10);
+  slots.set(5, 1, 4);
+  slots.resize(200);
+  slots.set(150, 1, 1);
+  auto taken = take_all(slots);
+  ASSERT_EQ(taken.size(), 2u);
+  EXPECT_EQ(taken[0], std::make_pair(size_t(5), uint8_t(4)));
+  EXPECT_EQ(taken[1], std::make_pair(size_t(150), uint8_t(1)));
+}
+
+// Every producer sets its own slots over and over while the calling thread
+// takes, no flag may get lost
+TEST(PendingSlotsTest, ProducersAgainstOneConsumer) {
+  constexpr int PRODUCERS = 8;
+  constexpr size_t SLOTS_PER_PRODUCER = 16;
+  constexpr int ROUNDS = 2000;
+  PendingSlots slots;
+  slots.resize(PRODUCERS * SLOTS_PER_PRODUCER);
+
+  std::atomic<int> finished{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < PRODUCERS; ++p) {
+    producers.emplace_back([&, p] {
+      for (int round = 0; round < ROUNDS; ++round) {
+        slots.set(p * SLOTS_PER_PRODUCER + round % SLOTS_PER_PRODUCER, 1, 1 << (round % 3));
+        if (round % 4 != 0)
+          std::this_thread::yield();
+      }
+      ++finished;
+    });
+  }
+
+  std::vector<uint8_t> seen(PRODUCERS * SLOTS_PER_PRODUCER, 0);
+  auto take = [&] { slots.take([&](size_t slot, uint8_t flags) { seen[slot] |= flags; }); };
+  while (finished < PRODUCERS)
+    take();
+  for (auto &producer : producers)
+    producer.join();
+  take();
+
+  // rounds of a slot step by SLOTS_PER_PRODUCER, which cycles through all flags
+  for (size_t slot = 0; slot < seen.size(); ++slot)
+    EXPECT_EQ(seen[slot], 7) << slot;
+  EXPECT_TRUE(take_all(slots).empty());
+}
+
+}  // namespace
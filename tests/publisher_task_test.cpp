@@ -0,0 +1,111 @@
+// PublisherTask on the host platform: the work runs on its own thread, on
+// wake-ups and after the time it asked for, and leaves the mutex to the main
+// loop; try_lock_publisher() never waits
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "publisher_task.h"
+
+namespace {
+
+using esphome::mqtt_homie::lock_publisher;
+using esphome::mqtt_homie::try_lock_publisher;
+using esphome::mqtt_homie::PublisherTask;
+using namespace std::chrono_literals;
+
+// Waits up to a second for condition
+template<typename F> bool eventually(F &&condition) {
+  const auto deadline = std::chrono::steady_clock::now() + 1s;
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+TEST(PublisherTaskTest, RunsWorkOnItsOwnThread) {
+  std::atomic<int> runs{0};
+  std::atomic<bool> other_thread{false};
+  const auto main_thread = std::this_thread::get_id();
+  {
+    PublisherTask task(1, 5, 4096);
+    EXPECT_FALSE(task.is_running());
+    ASSERT_TRUE(task.start([&] {
+      other_thread = std::this_thread::get_id() != main_thread;
+      ++runs;
+      return uint32_t(5);
+    }));
+    EXPECT_TRUE(task.is_running());
+    // the time the work asks for alone keeps it going
+    EXPECT_TRUE(eventually([&] { return runs >= 3; }));
+  }
+  // the destructor joined the thread
+  const int after_stop = runs;
+  std::this_thread::sleep_for(30ms);
+  EXPECT_EQ(runs, after_stop);
+  EXPECT_TRUE(other_thread);
+}
+
+TEST(PublisherTaskTest, IdleWorkWaitsForWake) {
+  std::atomic<int> runs{0};
+  PublisherTask task(1, 5, 4096);
+  ASSERT_TRUE(task.start([&] {
+    ++runs;
+    return PublisherTask::IDLE;
+  }));
+  // runs once after the start, then sleeps
+  EXPECT_TRUE(eventually([&] { return runs == 1; }));
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(runs, 1);
+  for (int i = 2; i <= 6; ++i) {
+    task.wake();
+    EXPECT_TRUE(eventually([&] { return runs >= i; })) << "wake-up " << i;
+  }
+}
+
+TEST(PublisherTaskTest, WorkDoesNotHoldTheLock) {
+  std::atomic<bool> running{false};
+  std::atomic<bool> release{false};
+  PublisherTask task(1, 5, 4096);
+  ASSERT_TRUE(task.start([&] {
+    running = true;
+    while (!release)
+      std::this_thread::sleep_for(100us);
+    return PublisherTask::IDLE;
+  }));
+  ASSERT_TRUE(eventually([&] { return running.load(); }));
+  {
+    // the work takes the mutex itself, around single handoffs only
+    std::unique_lock<esphome::Mutex> lock;
+    EXPECT_TRUE(try_lock_publisher(&task, lock));
+  }
+  release = true;
+}
+
+TEST(PublisherTaskTest, TryLockPublisherGivesUpWhileHeld) {
+  PublisherTask task(1, 5, 4096);
+  auto held = lock_publisher(&task);
+  EXPECT_TRUE(held.owns_lock());
+  std::thread other([&task] {
+    std::unique_lock<esphome::Mutex> lock;
+    EXPECT_FALSE(try_lock_publisher(&task, lock));
+  });
+  other.join();
+  held.unlock();
+  std::unique_lock<esphome::Mutex> lock;
+  EXPECT_TRUE(try_lock_publisher(&task, lock));
+  EXPECT_TRUE(lock.owns_lock());
+
+  // no task, no lock, always succeeds
+  auto none = lock_publisher(nullptr);
+  EXPECT_FALSE(none.owns_lock());
+  std::unique_lock<esphome::Mutex> none_try;
+  EXPECT_TRUE(try_lock_publisher(nullptr, none_try));
+}
+
+}  // namespace
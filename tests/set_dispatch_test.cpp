@@ -0,0 +1,153 @@
+// Inbound set commands are resolved and applied without touching the heap and
+// reported once per applied value. Counts global allocations around
+// homie::client's on_message() and reports the time per dispatch.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <gtest/gtest.h>
+
+#include "homie_mocks.h"
+
+static std::atomic<bool> g_counting{false};
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size) {
+  if (g_counting.load(std::memory_order_relaxed))
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using namespace homie_test;
+
+// Allocations made by fn
+template<typename F> size_t count_allocations(F &&fn) {
+  g_allocations = 0;
+  g_counting = true;
+  fn();
+  g_counting = false;
+  return g_allocations;
+}
+
+class SetDispatchTest : public ::testing::Test {
+ protected:
+  SetDispatchTest()
+      : brightness("brightness", homie::datatype::integer, "0:100"),
+        power("power", homie::datatype::boolean),
+        effect("effect", homie::datatype::enumeration, "none,rainbow,strobe"),
+        light("light"),
+        relay("relay"),
+        dev("dev"),
+        client(mqtt, &dev) {
+    light.properties = {&brightness, &effect};
+    relay.properties = {&power};
+    dev.nodes = {&light, &relay};
+    client.start_subscription();
+  }
+
+  mock_property brightness, power, effect;
+  mock_node light, relay;
+  mock_device dev;
+  mock_mqtt mqtt;
+  homie::client client;
+};
+
+TEST_F(SetDispatchTest, SubscribesToSetTopics) {
+  ASSERT_EQ(mqtt.subscriptions.size(), 1u);
+  EXPECT_EQ(mqtt.subscriptions[0], "homie/dev/+/+/set");
+}
+
+TEST_F(SetDispatchTest, TypedSetAppliesValue) {
+  mqtt.deliver("homie/dev/light/brightness/set", "42");
+  EXPECT_EQ(brightness.typed_sets, 1u);
+  EXPECT_EQ(brightness.current.integer, 42);
+
+  // same value again is not applied, out of range is left to set_value()
+  mqtt.deliver("homie/dev/light/brightness/set", "42");
+  EXPECT_EQ(brightness.typed_sets, 1u);
+  mqtt.deliver("homie/dev/light/brightness/set", "101");
+  EXPECT_EQ(brightness.typed_sets, 1u);
+  EXPECT_EQ(brightness.string_sets, 1u);
+
+  mqtt.deliver("homie/dev/relay/power/set", "true");
+  EXPECT_TRUE(power.current.boolean);
+  mqtt.deliver("homie/dev/light/effect/set", "strobe");
+  EXPECT_EQ(effect.current.enum_index, 2u);
+}
+
+TEST_F(SetDispatchTest, SetCallbackOncePerAppliedMessage) {
+  mock_handler handler;
+  client.set_event_handler(&handler);
+  mqtt.deliver("homie/dev/light/brightness/set", "42");
+  EXPECT_EQ(handler.sets, 1u);
+  // unchanged value, nothing applied
+  mqtt.deliver("homie/dev/light/brightness/set", "42");
+  EXPECT_EQ(handler.sets, 1u);
+
+  // typed set refused, the string path applies it
+  brightness.typed_set_accepted = false;
+  mqtt.deliver("homie/dev/light/brightness/set", "43");
+  EXPECT_EQ(handler.sets, 2u);
+  EXPECT_EQ(brightness.string_sets, 1u);
+  client.set_event_handler(nullptr);
+}
+
+TEST_F(SetDispatchTest, UnknownTopicsAreIgnored) {
+  mqtt.deliver("homie/dev/light/missing/set", "1");
+  mqtt.deliver("homie/dev/light/brightness", "1");
+  mqtt.deliver("homie/other/light/brightness/set", "1");
+  EXPECT_EQ(brightness.typed_sets + brightness.string_sets, 0u);
+}
+
+TEST_F(SetDispatchTest, TypedSetDoesNotAllocate) {
+  // topics and payloads arrive as std::string from the transport, build them
+  // outside of the counted section
+  const std::string topics[] = {"homie/dev/light/brightness/set", "homie/dev/relay/power/set",
+                                "homie/dev/light/effect/set", "homie/dev/light/missing/set"};
+  const std::string payloads[][2] = {
+      {"10", "90"}, {"true", "false"}, {"rainbow", "none"}, {"1", "2"}};
+
+  constexpr int ROUNDS = 20000;
+  size_t allocations = 0;
+  const auto start = std::chrono::steady_clock::now();
+  allocations = count_allocations([&] {
+    for (int i = 0; i < ROUNDS; ++i) {
+      for (size_t t = 0; t < 4; ++t)
+        mqtt.deliver(topics[t], payloads[t][i & 1]);
+    }
+  });
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(allocations, 0u);
+  EXPECT_EQ(brightness.typed_sets, size_t(ROUNDS));
+  EXPECT_EQ(power.typed_sets, size_t(ROUNDS));
+  EXPECT_EQ(effect.typed_sets, size_t(ROUNDS));
+  const double ns =
+      std::chrono::duration<double, std::nano>(elapsed).count() / (ROUNDS * 4.0);
+  std::printf("set dispatch: %.1f ns per message, %zu allocations\n", ns, allocations);
+}
+
+TEST_F(SetDispatchTest, StringFallbackAllocates) {
+  // reference point for the typed path: properties without typed support go
+  // through get_value()/set_value() and std::string copies
+  brightness.typed = false;
+  const std::string topic = "homie/dev/light/brightness/set";
+  const std::string payloads[] = {"this payload is longer than SSO", "another long payload text"};
+  const size_t allocations = count_allocations([&] {
+    for (int i = 0; i < 100; ++i)
+      mqtt.deliver(topic, payloads[i & 1]);
+  });
+  EXPECT_EQ(brightness.string_sets, 100u);
+  EXPECT_GT(allocations, 0u);
+}
+
+}  // namespace
@@ -0,0 +1,3 @@
+#pragma once
+// Stand-in for the header ESPHome generates per configuration, the tests build
+// with USE_HOST set on the command line
@@ -0,0 +1,31 @@
+#pragma once
+// Stand-in for the parts of ESPHome's helpers the host tests need
+
+#include <mutex>
+
+namespace esphome {
+
+class Mutex {
+ public:
+  Mutex() = default;
+  Mutex(const Mutex &) = delete;
+  Mutex &operator=(const Mutex &) = delete;
+
+  void lock() { m_mutex.lock(); }
+  bool try_lock() { return m_mutex.try_lock(); }
+  void unlock() { m_mutex.unlock(); }
+
+ private:
+  std::mutex m_mutex;
+};
+
+class LockGuard {
+ public:
+  LockGuard(Mutex &mutex) : m_mutex(mutex) { m_mutex.lock(); }
+  ~LockGuard() { m_mutex.unlock(); }
+
+ private:
+  Mutex &m_mutex;
+};
+
+}  // namespace esphome
@@ -0,0 +1,86 @@
+// Unchanged values are skipped only when the last value actually left the
+// device, and device info counts only metadata that was published
+
+#include <gtest/gtest.h>
+
+#include "homie_mocks.h"
+
+namespace {
+
+using namespace homie_test;
+
+class ValueDigestTest : public ::testing::Test {
+ protected:
+  ValueDigestTest()
+      : temperature("temperature", homie::datatype::number, {}, false),
+        sensor("sensor"),
+        dev("dev"),
+        client(mqtt, &dev) {
+    sensor.properties = {&temperature};
+    dev.nodes = {&sensor};
+    client.start_subscription();
+  }
+
+  // notification for a changed temperature, the mock queues every publish
+  size_t notify(const std::string &value) {
+    temperature.value = value;
+    mqtt.published.clear();
+    client.notify_property_changed(&sensor, &temperature);
+    return mqtt.published.size();
+  }
+
+  mock_property temperature;
+  mock_node sensor;
+  mock_device dev;
+  mock_mqtt mqtt;
+  homie::client client;
+};
+
+TEST_F(ValueDigestTest, QueuedValueIsNotAssumedPublished) {
+  EXPECT_EQ(notify("21.5"), 1u);
+  // still queued, maybe dropped later: publish again
+  EXPECT_EQ(notify("21.5"), 1u);
+}
+
+TEST_F(ValueDigestTest, SentValueIsSkipped) {
+  EXPECT_EQ(notify("21.5"), 1u);
+  mqtt.handler->on_published(mqtt.published[0].topic, mqtt.published[0].payload);
+  EXPECT_EQ(notify("21.5"), 0u);
+  EXPECT_EQ(client.get_values_skipped(), 1u);
+  EXPECT_EQ(notify("22.0"), 1u);
+}
+
+TEST_F(ValueDigestTest, NewerQueuedValueInvalidatesDigest) {
+  EXPECT_EQ(notify("21.5"), 1u);
+  mqtt.handler->on_published(mqtt.published[0].topic, mqtt.published[0].payload);
+  // 22.0 is queued and then replaced by 21.5 again, which must not be skipped
+  EXPECT_EQ(notify("22.0"), 1u);
+  EXPECT_EQ(notify("21.5"), 1u);
+}
+
+TEST_F(ValueDigestTest, DeviceInfoCountsPublishedMetadataOnly) {
+  auto metadata_published = [this] {
+    size_t count = 0;
+    for (auto &msg : mqtt.published)
+      count += msg.type == homie::message_class::metadata;
+    return count;
+  };
+
+  mqtt.published.clear();
+  client.publish_device_info();
+  while (client.continue_device_info(16)) {
+  }
+  EXPECT_GT(metadata_published(), 0u);
+  EXPECT_EQ(client.get_device_info_messages(), metadata_published());
+
+  // metadata assumed retained on the broker, only values go out
+  mqtt.published.clear();
+  client.publish_device_info(true);
+  while (client.continue_device_info(16)) {
+  }
+  EXPECT_EQ(metadata_published(), 0u);
+  EXPECT_EQ(client.get_device_info_messages(), 0u);
+  EXPECT_EQ(client.get_device_info_bytes(), 0u);
+}
+
+}  // namespace
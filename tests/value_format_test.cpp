@@ -0,0 +1,120 @@
+// Stack formatting of numeric payloads: output matches printf, small buffers
+// are never overrun and the time per value is reported next to snprintf into
+// a std::string
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "homie-cpp/value_format.h"
+
+namespace {
+
+// printf("%.*f") without the sign of a negative zero, which format_fixed drops
+std::string printf_fixed(double value, int accuracy) {
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.*f", accuracy, value);
+  if (buffer[0] == '-' && std::strspn(buffer + 1, "0.") == std::strlen(buffer + 1))
+    return buffer + 1;
+  return buffer;
+}
+
+std::string fixed(double value, int accuracy) {
+  char buffer[homie::value_buffer_size];
+  return std::string(buffer, homie::format_fixed(buffer, sizeof(buffer), value, accuracy));
+}
+
+// sensor readings: floats of a few magnitudes
+std::vector<float> sample_values(size_t count) {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> mantissa(-1, 1);
+  std::uniform_int_distribution<int> exponent(-3, 6);
+  std::vector<float> values(count);
+  for (auto &value : values)
+    value = mantissa(random) * std::pow(10.0f, exponent(random));
+  return values;
+}
+
+TEST(ValueFormatTest, IntegersMatchPrintf) {
+  const int64_t values[] = {0, 1, -1, 9, 10, 1234567890, INT64_MAX, INT64_MIN};
+  for (auto value : values) {
+    char buffer[homie::value_buffer_size];
+    const size_t length = homie::format_integer(buffer, sizeof(buffer), value);
+    EXPECT_EQ(std::string(buffer, length), std::to_string(value));
+  }
+  char small[3];
+  EXPECT_EQ(homie::format_integer(small, sizeof(small), 123), 0u);
+  EXPECT_EQ(homie::format_integer(small, sizeof(small), 12), 2u);
+}
+
+TEST(ValueFormatTest, FixedMatchesPrintf) {
+  for (float value : sample_values(100000)) {
+    for (int accuracy = 0; accuracy <= 3; ++accuracy)
+      ASSERT_EQ(fixed(value, accuracy), printf_fixed(value, accuracy))
+          << "value " << value << " accuracy " << accuracy;
+  }
+}
+
+TEST(ValueFormatTest, FixedSpecialValues) {
+  EXPECT_EQ(fixed(0.125, 2), "0.12");
+  EXPECT_EQ(fixed(0.375, 2), "0.38");
+  EXPECT_EQ(fixed(-0.04, 1), "0.0");
+  EXPECT_EQ(fixed(1234.5, -2), "1200");
+  EXPECT_EQ(fixed(NAN, 1), "nan");
+  EXPECT_EQ(fixed(-INFINITY, 1), "-inf");
+  EXPECT_EQ(fixed(1e20, 1), printf_fixed(1e20, 1));
+}
+
+TEST(ValueFormatTest, SmallBuffersAreNotOverrun) {
+  // guard bytes around the usable size, all must stay untouched
+  char buffer[homie::value_buffer_size + 2];
+  for (size_t size = 0; size <= 8; ++size) {
+    for (double value : {-12.5, 12.5, -1.0, 0.0}) {
+      for (int accuracy : {-1, 0, 2}) {
+        std::memset(buffer, '#', sizeof(buffer));
+        const size_t length = homie::format_fixed(buffer + 1, size, value, accuracy);
+        EXPECT_EQ(buffer[0], '#');
+        for (size_t i = size + 1; i < sizeof(buffer); ++i)
+          EXPECT_EQ(buffer[i], '#') << size << " " << value << " " << accuracy;
+        if (length != 0)
+          EXPECT_EQ(std::string(buffer + 1, length), fixed(value, accuracy));
+      }
+    }
+  }
+}
+
+TEST(ValueFormatTest, Benchmark) {
+  const auto values = sample_values(100000);
+  size_t total = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (float value : values) {
+    char buffer[homie::value_buffer_size];
+    total += homie::format_fixed(buffer, sizeof(buffer), value, 2);
+  }
+  const auto stack = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (float value : values) {
+    char buffer[64];
+    const int length = std::snprintf(buffer, sizeof(buffer), "%.*f", 2, value);
+    total += std::string(buffer, length).size();
+  }
+  const auto printf = std::chrono::steady_clock::now() - start;
+
+  // keeps the loops from being optimized away
+  EXPECT_GT(total, 0u);
+  auto per_value = [&values](std::chrono::steady_clock::duration elapsed) {
+    return std::chrono::duration<double, std::nano>(elapsed).count() / values.size();
+  };
+  std::printf("format_fixed: %.1f ns per value, snprintf + std::string: %.1f ns per value\n",
+              per_value(stack), per_value(printf));
+}
+
+}  // namespace